@@ -0,0 +1,154 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "d6.h"
+
+
+/**
+ * Number of samples drawn at once by `d6_alias_sample()`
+ */
+#define ALIAS_BATCH 256
+
+
+int
+d6_alias_init(
+    struct d6_alias* alias,
+    struct d6_dist const* dist
+) {
+    size_t const len = dist->len;
+    alias->dice = dist->dice;
+    alias->len = len;
+    alias->threshold = malloc(len * sizeof(*alias->threshold));
+    alias->alias = malloc(len * sizeof(*alias->alias));
+
+    // Vose's method: scaled probabilities below 1 are topped up by the
+    // remainder of one above 1, which may in turn drop below 1
+    long double* const scaled = malloc(len * sizeof(*scaled));
+    uint32_t* const small = malloc(len * sizeof(*small));
+    uint32_t* const large = malloc(len * sizeof(*large));
+    if (!alias->threshold || !alias->alias || !scaled || !small || !large) {
+        free(scaled);
+        free(small);
+        free(large);
+        d6_alias_release(alias);
+        return -1;
+    }
+
+    size_t small_count = 0;
+    size_t large_count = 0;
+    for (size_t index = 0; index < len; ++index) {
+        scaled[index] = dist->pmf[index] * len;
+        if (scaled[index] < 1)
+            small[small_count++] = index;
+        else
+            large[large_count++] = index;
+    }
+
+    while (small_count > 0 && large_count > 0) {
+        uint32_t const less = small[--small_count];
+        uint32_t const more = large[large_count - 1];
+        alias->threshold[less] = ldexpl(scaled[less], 64);
+        alias->alias[less] = more;
+
+        scaled[more] -= 1 - scaled[less];
+        if (scaled[more] < 1) {
+            --large_count;
+            small[small_count++] = more;
+        }
+    }
+
+    // whatever remains has a scaled probability of 1 up to rounding errors
+    while (small_count > 0) {
+        uint32_t const index = small[--small_count];
+        alias->alias[index] = index;
+    }
+    while (large_count > 0) {
+        uint32_t const index = large[--large_count];
+        alias->alias[index] = index;
+    }
+
+    free(scaled);
+    free(small);
+    free(large);
+    return 0;
+}
+
+
+void
+d6_alias_release(
+    struct d6_alias* alias
+) {
+    free(alias->threshold);
+    free(alias->alias);
+    alias->threshold = NULL;
+    alias->alias = NULL;
+}
+
+
+int
+d6_alias_sample(
+    struct d6_alias const* alias,
+    struct d6_pool* pool,
+    uint64_t* sums,
+    size_t count
+) {
+    uint32_t const len = alias->len;
+    // values of a 32bit word below this are rejected when reducing modulo
+    // `len`, making the index uniformly distributed
+    uint32_t const reject = -len % len;
+
+    while (count > 0) {
+        size_t batch = ALIAS_BATCH;
+        if (count < batch)
+            batch = count;
+
+        uint32_t words[ALIAS_BATCH];
+        uint64_t coins[ALIAS_BATCH];
+        if (d6_pool_read(pool, words, batch * sizeof(*words)) < 0 ||
+                d6_pool_read(pool, coins, batch * sizeof(*coins)) < 0)
+            return -1;
+
+        for (size_t sample = 0; sample < batch; ++sample) {
+            uint64_t product = (uint64_t) words[sample] * len;
+            while ((uint32_t) product < reject) {
+                uint32_t word;
+                if (d6_pool_read(pool, &word, sizeof(word)) < 0)
+                    return -1;
+                product = (uint64_t) word * len;
+            }
+
+            uint32_t index = product >> 32;
+            if (alias->alias[index] != index &&
+                    coins[sample] >= alias->threshold[index])
+                index = alias->alias[index];
+            sums[sample] = alias->dice + index;
+        }
+
+        sums += batch;
+        count -= batch;
+    }
+    return 0;
+}
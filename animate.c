@@ -0,0 +1,273 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "animate.h"
+
+
+/**
+ * Number of frames of an animation
+ *
+ * The dice tumble during the first half of the frames and settle during the
+ * second half.
+ */
+#define ANIMATE_FRAMES 30
+
+
+/**
+ * Number of characters of a row of a dice face, excluding the space after it
+ */
+#define FACE_WIDTH 14
+
+
+/**
+ * Maximum length of the cursor movement preceding a row of a face
+ */
+#define MOVE_LEN 32
+
+
+/**
+ * Position of the cursor, relative to the first line of the dice
+ */
+struct cursor {
+    unsigned int line; ///< line, starting at `0`
+    unsigned int column; ///< column, starting at `1`
+};
+
+
+/**
+ * Format the escape sequences moving the cursor to a position
+ *
+ * Returns the number of characters formatted, at most `MOVE_LEN`.
+ */
+static size_t
+move_cursor(
+    char* text, ///< buffer to format to
+    struct cursor* cursor, ///< current position, updated
+    unsigned int line, ///< line to move to
+    unsigned int column ///< column to move to
+) {
+    int len = 0;
+    if (line < cursor->line)
+        len += sprintf(text + len, "\033[%uA", cursor->line - line);
+    else if (line > cursor->line)
+        len += sprintf(text + len, "\033[%uB", line - cursor->line);
+    if (column != cursor->column)
+        len += sprintf(text + len, "\033[%uG", column);
+
+    cursor->line = line;
+    cursor->column = column;
+    return len;
+}
+
+
+/**
+ * Render the changes between two frames
+ *
+ * Only the rows with pips can differ between faces. For every die whose
+ * value changed, those rows are rewritten if they differ. Finally, the cursor
+ * is moved back below the dice.
+ *
+ * Returns the number of characters rendered.
+ */
+static size_t
+render_changes(
+    char* text, ///< buffer to render to
+    struct cursor* cursor, ///< current position of the cursor, updated
+    uint8_t const* shown, ///< values currently shown
+    uint8_t const* values, ///< values to show
+    unsigned int count, ///< number of dice
+    unsigned int band, ///< number of dice side by side
+    unsigned int lines ///< number of lines taken by the dice
+) {
+    char* pos = text;
+    for (unsigned int dice = 0; dice < count; ++dice) {
+        if (shown[dice] == values[dice])
+            continue;
+
+        for (uint8_t row = 1; row < 7; row += 2) {
+            struct iovec const old = d6_row_vec(row, shown[dice]);
+            struct iovec const new = d6_row_vec(row, values[dice]);
+            if (old.iov_base == new.iov_base)
+                continue;
+
+            pos += move_cursor(pos, cursor, dice / band * 8 + row,
+                               dice % band * (FACE_WIDTH + 2) + 1);
+            memcpy(pos, new.iov_base, FACE_WIDTH);
+            pos += FACE_WIDTH;
+            cursor->column += FACE_WIDTH;
+        }
+    }
+
+    pos += move_cursor(pos, cursor, lines, 1);
+    return pos - text;
+}
+
+
+/**
+ * Render the first frame of an animation in full
+ *
+ * Returns the number of characters rendered.
+ */
+static size_t
+render_frame(
+    char* text, ///< buffer to render to
+    uint8_t const* values, ///< values to show
+    unsigned int count, ///< number of dice
+    unsigned int band ///< number of dice side by side
+) {
+    char* pos = text;
+    for (unsigned int first = 0; first < count; first += band) {
+        unsigned int dice = band;
+        if (count - first < dice)
+            dice = count - first;
+
+        if (first > 0)
+            *pos++ = '\n';
+        pos += d6_render_text(pos, values + first, dice);
+    }
+    return pos - text;
+}
+
+
+int
+animate(
+    struct d6* d6,
+    struct output* out,
+    unsigned int count,
+    unsigned int band,
+    unsigned int fps
+) {
+    static uint8_t values[ANIMATE_MAX_DICE];
+    static uint8_t shown[ANIMATE_MAX_DICE];
+    static uint8_t next[ANIMATE_MAX_DICE];
+
+    if (count < 1 || count > ANIMATE_MAX_DICE || fps < 1 ||
+            fps > ANIMATE_MAX_FPS)
+        return -1;
+    if (d6_roll(d6, values, count) < 0 || d6_roll_batch(d6, shown, count) < 0)
+        return -1;
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+        return -1;
+
+    int const sig_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    int const timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    long const interval = 1000000000L / fps;
+    struct itimerspec const timer = {
+        .it_interval = {interval / 1000000000L, interval % 1000000000L},
+        .it_value = {interval / 1000000000L, interval % 1000000000L},
+    };
+    int res = -1;
+    if (sig_fd < 0 || timer_fd < 0 || timerfd_settime(timer_fd, 0, &timer,
+                                                      NULL) < 0)
+        goto out;
+
+    unsigned int const bands = (count + band - 1) / band;
+    unsigned int const lines = 8 * bands - 1;
+    struct cursor cursor = {.line = lines, .column = 1};
+
+    // hide the cursor while animating
+    if (output_write(out, "\033[?25l", 6) < 0)
+        goto out;
+    char* text = output_reserve(out, D6_RENDER_TEXT_LEN(band) * bands + bands);
+    if (!text)
+        goto out;
+    output_commit(out, render_frame(text, shown, count, band));
+    if (output_flush(out) < 0)
+        goto out;
+
+    unsigned int const tumbling = ANIMATE_FRAMES / 2;
+    for (unsigned int frame = 0; frame < ANIMATE_FRAMES - 1;) {
+        struct pollfd fds[2] = {
+            {.fd = timer_fd, .events = POLLIN},
+            {.fd = sig_fd, .events = POLLIN},
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            goto restore;
+        }
+        if (fds[1].revents) {
+            // consume the signal so it is not delivered once unblocked
+            struct signalfd_siginfo info;
+            if (read(sig_fd, &info, sizeof(info)) == sizeof(info))
+                res = 0;
+            goto restore;
+        }
+
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) !=
+                sizeof(expirations))
+            continue;
+        frame += expirations;
+        if (frame > ANIMATE_FRAMES - 1)
+            frame = ANIMATE_FRAMES - 1;
+
+        // dice settle one after the other during the second half
+        if (d6_roll_batch(d6, next, count) < 0)
+            goto restore;
+        for (unsigned int dice = 0; dice < count; ++dice)
+            if (frame >= tumbling + (dice + 1) * (ANIMATE_FRAMES - 1 -
+                    tumbling) / count)
+                next[dice] = values[dice];
+
+        text = output_reserve(out, 3 * count * (MOVE_LEN + FACE_WIDTH) +
+                              MOVE_LEN);
+        if (!text)
+            goto restore;
+        output_commit(out, render_changes(text, &cursor, shown, next, count,
+                                          band, lines));
+        if (output_flush(out) < 0)
+            goto restore;
+        memcpy(shown, next, count);
+    }
+    res = 0;
+
+restore:
+    // the cursor is left below the dice after each frame
+    if (output_write(out, "\033[?25h", 6) < 0)
+        res = -1;
+
+out:
+    if (timer_fd >= 0)
+        close(timer_fd);
+    if (sig_fd >= 0)
+        close(sig_fd);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    return res;
+}
@@ -0,0 +1,76 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef ANIMATE_H
+#define ANIMATE_H
+
+#include "d6.h"
+#include "output.h"
+
+
+/**
+ * Animate a roll of dice
+ *
+ * The dice tumble for a number of frames before settling one after the other
+ * on the values rolled. They are laid out in bands like still dice. After the
+ * first frame, only the rows of faces which changed are rewritten, with ANSI
+ * escape sequences moving the cursor. Hence, the amount of data per frame
+ * depends on the number of dice changing rather than on the number of dice.
+ * Frames are paced via a timerfd. If frames are missed, the animation skips
+ * ahead rather than slowing down. The cursor is hidden while animating. The
+ * dice must fit on the screen.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+animate(
+    struct d6* d6, ///< state to roll dice with
+    struct output* out, ///< output to animate on
+    unsigned int count, ///< number of dice, at most `ANIMATE_MAX_DICE`
+    unsigned int band, ///< number of dice side by side
+    unsigned int fps ///< frames per second, at most `ANIMATE_MAX_FPS`
+);
+
+
+/**
+ * Maximum number of dice animated
+ */
+#define ANIMATE_MAX_DICE 4800
+
+
+/**
+ * Default number of frames per second
+ */
+#define ANIMATE_FPS 25
+
+
+/**
+ * Maximum number of frames per second
+ *
+ * Frames are paced by a timer with an interval of whole nanoseconds, which
+ * must not be zero.
+ */
+#define ANIMATE_MAX_FPS 1000
+
+
+#endif
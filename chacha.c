@@ -0,0 +1,125 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+
+#include "d6.h"
+
+
+/**
+ * Rotate a 32bit value to the left
+ */
+#define ROTL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+
+/**
+ * ChaCha quarter round
+ */
+#define QUARTER_ROUND(a, b, c, d) \
+    do { \
+        a += b; d ^= a; d = ROTL(d, 16); \
+        c += d; b ^= c; b = ROTL(b, 12); \
+        a += b; d ^= a; d = ROTL(d, 8); \
+        c += d; b ^= c; b = ROTL(b, 7); \
+    } while (0)
+
+
+/**
+ * Read a 32bit little endian value
+ */
+static uint32_t
+load_le32(
+    uint8_t const* bytes ///< bytes to read
+) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+        (uint32_t) bytes[3] << 24;
+}
+
+
+void
+d6_chacha_init(
+    struct d6_chacha* chacha,
+    uint8_t const* key,
+    uint64_t nonce
+) {
+    for (int word = 0; word < 8; ++word)
+        chacha->key[word] = load_le32(key + 4 * word);
+    chacha->nonce = nonce;
+    chacha->counter = 0;
+}
+
+
+void
+d6_chacha_block(
+    struct d6_chacha const* chacha,
+    uint64_t counter,
+    uint8_t* out
+) {
+    uint32_t const input[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        chacha->key[0], chacha->key[1], chacha->key[2], chacha->key[3],
+        chacha->key[4], chacha->key[5], chacha->key[6], chacha->key[7],
+        counter, counter >> 32, chacha->nonce, chacha->nonce >> 32
+    };
+
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    for (int round = 0; round < 10; ++round) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int word = 0; word < 16; ++word) {
+        uint32_t const value = x[word] + input[word];
+        out[4 * word] = value;
+        out[4 * word + 1] = value >> 8;
+        out[4 * word + 2] = value >> 16;
+        out[4 * word + 3] = value >> 24;
+    }
+}
+
+
+void
+d6_chacha_generate(
+    struct d6_chacha* chacha,
+    void* dest,
+    size_t len
+) {
+    uint8_t* pos = dest;
+    for (; len >= D6_CHACHA_BLOCK_LEN; len -= D6_CHACHA_BLOCK_LEN) {
+        d6_chacha_block(chacha, chacha->counter++, pos);
+        pos += D6_CHACHA_BLOCK_LEN;
+    }
+
+    if (len > 0) {
+        uint8_t block[D6_CHACHA_BLOCK_LEN];
+        d6_chacha_block(chacha, chacha->counter++, block);
+        memcpy(pos, block, len);
+    }
+}
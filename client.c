@@ -0,0 +1,165 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "d6.h"
+
+
+/**
+ * Receive exactly a given number of bytes
+ *
+ * If `buf` is `NULL`, the bytes are discarded.
+ *
+ * Returns `0` on success, `-1` on error or if the connection was closed early.
+ */
+static int
+recv_all(
+    int fd, ///< socket to receive from
+    uint8_t* buf, ///< buffer to fill
+    size_t len ///< number of bytes to receive
+) {
+    uint8_t scratch[256];
+    while (len > 0) {
+        uint8_t* const dest = buf ? buf : scratch;
+        size_t want = len;
+        if (!buf && want > sizeof(scratch))
+            want = sizeof(scratch);
+
+        ssize_t got = recv(fd, dest, want, 0);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (got == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (buf)
+            buf += got;
+        len -= got;
+    }
+    return 0;
+}
+
+
+int
+d6_client_open(
+    char const* path
+) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int
+d6_client_send(
+    int fd,
+    uint32_t count,
+    uint8_t sides,
+    enum d6_serve_format format
+) {
+    uint8_t const request[D6_SERVE_REQUEST_LEN] = {
+        count, count >> 8, count >> 16, count >> 24, sides, format, 0, 0
+    };
+
+    size_t sent = 0;
+    while (sent < sizeof(request)) {
+        ssize_t res = send(fd, request + sent, sizeof(request) - sent,
+                           MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += res;
+    }
+    return 0;
+}
+
+
+ssize_t
+d6_client_recv(
+    int fd,
+    void* buf,
+    size_t len
+) {
+    uint8_t header[D6_SERVE_RESPONSE_LEN];
+    if (recv_all(fd, header, sizeof(header)) < 0)
+        return -1;
+
+    uint32_t const payload = (uint32_t) header[4] | (uint32_t) header[5] << 8 |
+        (uint32_t) header[6] << 16 | (uint32_t) header[7] << 24;
+    if (payload > len) {
+        if (recv_all(fd, NULL, payload) == 0)
+            errno = EMSGSIZE;
+        return -1;
+    }
+    if (recv_all(fd, buf, payload) < 0)
+        return -1;
+
+    switch (header[0]) {
+    case D6_SERVE_OK:
+        return payload;
+    case D6_SERVE_INVALID:
+        errno = EINVAL;
+        return -1;
+    default:
+        errno = EIO;
+        return -1;
+    }
+}
+
+
+ssize_t
+d6_client_roll(
+    int fd,
+    uint32_t count,
+    uint8_t sides,
+    enum d6_serve_format format,
+    void* buf,
+    size_t len
+) {
+    if (d6_client_send(fd, count, sides, format) < 0)
+        return -1;
+    return d6_client_recv(fd, buf, len);
+}
@@ -0,0 +1,230 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "d6.h"
+
+/**
+ * This program generates load on a d6 daemon and reports the latency of the
+ * requests. Each connection is driven by a thread of its own, which keeps a
+ * number of requests in flight.
+ */
+
+
+/**
+ * Maximum number of requests in flight per connection
+ */
+#define MAX_DEPTH 64
+
+
+/**
+ * State of a connection driven by a thread
+ */
+struct client {
+    pthread_t thread; ///< thread driving the connection
+    char const* path; ///< path of the daemon's socket
+    unsigned long requests; ///< number of requests to send
+    unsigned int depth; ///< number of requests in flight
+    uint32_t dice; ///< number of dice per request
+    enum d6_serve_format format; ///< format of the responses
+    uint64_t* latencies; ///< latency of each request in nanoseconds
+    int error; ///< `errno` of the failure, `0` on success
+};
+
+
+/**
+ * Get the current time in nanoseconds
+ */
+uint64_t
+now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+
+/**
+ * Send requests over a connection and record their latencies
+ *
+ * Up to `depth` requests are sent ahead. The latency of a request is the time
+ * between sending it and receiving its response.
+ */
+void*
+drive(
+    void* arg ///< client to drive
+) {
+    struct client* const client = arg;
+    uint64_t sent_at[MAX_DEPTH];
+
+    uint8_t* const payload = malloc(D6_SERVE_MAX_PAYLOAD);
+    int const fd = d6_client_open(client->path);
+    if (!payload || fd < 0)
+        goto out;
+
+    unsigned long sent = 0;
+    for (unsigned long received = 0; received < client->requests; ++received) {
+        while (sent < client->requests && sent - received < client->depth) {
+            sent_at[sent % MAX_DEPTH] = now();
+            if (d6_client_send(fd, client->dice, 6, client->format) < 0)
+                goto out;
+            ++sent;
+        }
+
+        if (d6_client_recv(fd, payload, D6_SERVE_MAX_PAYLOAD) < 0)
+            goto out;
+        client->latencies[received] = now() - sent_at[received % MAX_DEPTH];
+    }
+    free(payload);
+    close(fd);
+    return NULL;
+
+out:
+    client->error = errno ? errno : EIO;
+    free(payload);
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+
+/**
+ * Compare two latencies for sorting
+ */
+int
+compare_latency(
+    void const* a, ///< first latency
+    void const* b ///< second latency
+) {
+    uint64_t const lhs = *(uint64_t const*) a;
+    uint64_t const rhs = *(uint64_t const*) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+
+/**
+ * Get a percentile from sorted latencies in microseconds
+ */
+double
+percentile(
+    uint64_t const* latencies, ///< sorted latencies
+    size_t count, ///< number of latencies
+    double fraction ///< fraction of latencies below the percentile
+) {
+    size_t index = fraction * count;
+    if (index >= count)
+        index = count - 1;
+    return latencies[index] * 1e-3;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SOCKET [--connections N] [--requests N] "
+                "[--depth N] [--dice N] [--numeric|--faces]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int connections = 1;
+    unsigned long requests = 100000;
+    unsigned int depth = 1;
+    uint32_t dice = 1;
+    enum d6_serve_format format = D6_SERVE_VALUES;
+
+    for (int arg = 2; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--numeric") == 0) {
+            format = D6_SERVE_NUMERIC;
+        } else if (strcmp(argv[arg], "--faces") == 0) {
+            format = D6_SERVE_FACES;
+        } else if (arg + 1 >= argc) {
+            return 1;
+        } else if (strcmp(argv[arg], "--connections") == 0) {
+            connections = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--requests") == 0) {
+            requests = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--depth") == 0) {
+            depth = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--dice") == 0) {
+            dice = atoi(argv[++arg]);
+        } else {
+            return 1;
+        }
+    }
+    if (connections < 1 || requests < 1 || depth < 1 || depth > MAX_DEPTH ||
+            dice < 1 || dice > D6_SERVE_MAX_DICE)
+        return 1;
+
+    // each connection issues `requests` requests
+    size_t const total = (size_t) connections * requests;
+    struct client* const clients = calloc(connections, sizeof(*clients));
+    uint64_t* const latencies = malloc(total * sizeof(*latencies));
+    if (!clients || !latencies)
+        return 1;
+
+    uint64_t const start = now();
+    unsigned int started = 0;
+    for (; started < connections; ++started) {
+        struct client* const client = clients + started;
+        client->path = argv[1];
+        client->requests = requests;
+        client->depth = depth;
+        client->dice = dice;
+        client->format = format;
+        client->latencies = latencies + started * requests;
+        if (pthread_create(&client->thread, NULL, drive, client) != 0)
+            break;
+    }
+
+    int res = started < connections ? -1 : 0;
+    for (unsigned int index = 0; index < started; ++index) {
+        pthread_join(clients[index].thread, NULL);
+        if (clients[index].error) {
+            fprintf(stderr, "connection %u: %s\n", index,
+                    strerror(clients[index].error));
+            res = -1;
+        }
+    }
+    double const secs = (now() - start) * 1e-9;
+    if (res < 0)
+        return 1;
+
+    qsort(latencies, total, sizeof(*latencies), compare_latency);
+    printf("requests:   %zu\n", total);
+    printf("throughput: %.0f requests/s\n", total / secs);
+    printf("p50:        %.1f us\n", percentile(latencies, total, 0.5));
+    printf("p99:        %.1f us\n", percentile(latencies, total, 0.99));
+    printf("p99.9:      %.1f us\n", percentile(latencies, total, 0.999));
+    printf("max:        %.1f us\n", latencies[total - 1] * 1e-3);
+
+    free(latencies);
+    free(clients);
+    return 0;
+}
@@ -21,13 +21,30 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include "animate.h"
+#include "d6.h"
+#include "output.h"
+#include "serve.h"
+
 
 /**
  * This program prints dice faces for random values as text. Each pixel is made
@@ -37,118 +54,2034 @@
 
 
 /**
- * Dice data
+ * Compute the probability for exceeding a given chi-square statistic
+ *
+ * This is the survival function of the chi-square distribution with 5 degrees
+ * of freedom, which applies for the face counts of a d6.
+ */
+double
+chi_square_p(
+    double chi_square ///< the chi-square statistic
+) {
+    double const x = chi_square;
+    return erfc(sqrt(x / 2)) +
+        sqrt(2 * x / M_PI) * exp(-x / 2) * (1 + x / 3);
+}
+
+
+/**
+ * Compute the chi-square statistic of face counts for fair dice
+ */
+double
+chi_square(
+    unsigned long long const* faces, ///< counts of faces 1 to 6 at 1 to 6
+    unsigned long long count ///< total number of dice
+) {
+    double const expected = count / 6.0;
+    double res = 0;
+    for (int face = 1; face <= 6; ++face) {
+        double const diff = faces[face] - expected;
+        res += diff * diff / expected;
+    }
+    return res;
+}
+
+
+/**
+ * Compute the number of seconds elapsed since a point in time
+ */
+double
+elapsed(
+    struct timespec const* start ///< point in time (`CLOCK_MONOTONIC`)
+) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) +
+        (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+/**
+ * Number of dice extracted at once by the benchmark
+ */
+#define BENCH_BATCH 4096
+
+
+/**
+ * Benchmark and check one way of rolling dice
+ *
+ * Rolls a number of dice and reports the throughput, the number of random bits
+ * consumed per dice and a chi-square test of the face counts for uniformity.
+ * The dice are rolled via `d6_roll_batch()` if `bulk` is set and via
+ * `d6_roll()` otherwise.
  *
- * There are nine positions for pips on each d6, which we enumerate starting
- * form `0`:
+ * Returns `0` on success, `-1` if rolling failed or the face counts are too
+ * unlikely (p < 10^-6) for fair dice.
+ */
+int
+bench_dice(
+    char const* name, ///< name of the method to report
+    struct d6* d6, ///< state to benchmark
+    int bulk, ///< whether to benchmark `d6_roll_batch()` instead of `d6_roll()`
+    unsigned long long count ///< number of dice to roll
+) {
+    static uint8_t values[BENCH_BATCH];
+    unsigned long long faces[7] = {0};
+    unsigned long long const used = d6->pool.used;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned long long left = count; left > 0;) {
+        size_t batch = BENCH_BATCH;
+        if (left < batch)
+            batch = left;
+
+        int const res = bulk ?
+            d6_roll_batch(d6, values, batch) :
+            d6_roll(d6, values, batch);
+        if (res < 0)
+            return -1;
+        d6_count_faces(faces, values, batch);
+
+        left -= batch;
+    }
+
+    double const secs = elapsed(&start);
+    double const stat = chi_square(faces, count);
+    double const p = chi_square_p(stat);
+
+    printf("%s:\n", name);
+    printf("  dice:       %llu\n", count);
+    printf("  time:       %.3f s\n", secs);
+    printf("  throughput: %.1f Mdice/s\n", count / secs * 1e-6);
+    printf("  bits/dice:  %.4f (optimum %.4f)\n",
+           (d6->pool.used - used) * 8.0 / count, log2(6));
+    printf("  chi-square: %.3f (p = %.4f)\n", stat, p);
+
+    return p < 1e-6 ? -1 : 0;
+}
+
+
+/**
+ * Benchmark and check the extraction of dice values
  *
- *     #######
- *     #0 1 2#
- *     #3 4 5#
- *     #6 7 8#
- *     #######
+ * Both individual and bulk rolls are benchmarked.
  *
- * Hence, we can represent the pip-configuration of a dice using 9 bits. The
- * six configurations for a d6 easily fit into a 64bit integer value. We even
- * have the luxury of starting at an offset without wasting memory.
+ * Returns `0` on success, `-1` if any of the benchmarks failed.
  */
-const uint64_t pips =
-    ((uint64_t) 0020) << (1*9) |
-    ((uint64_t) 0104) << (2*9) |
-    ((uint64_t) 0124) << (3*9) |
-    ((uint64_t) 0505) << (4*9) |
-    ((uint64_t) 0525) << (5*9) |
-    ((uint64_t) 0555) << (6*9);
+int
+bench_extraction(
+    struct d6* d6, ///< state to benchmark
+    unsigned long long count ///< number of dice to roll
+) {
+    if (count == 0)
+        return -1;
+
+    int res = bench_dice("roll", d6, 0, count);
+    if (bench_dice("batch", d6, 1, count) < 0)
+        res = -1;
+    return res;
+}
 
 
 /**
- * The length of a row for one dice, including the space after the dice
+ * Default number of dice rendered side by side
  *
- * 7 pixels for the dice face + the separating pixel, times 2 characters per
- * pixel.
+ * Unless the width of the terminal is known, rolls with more dice are rendered
+ * in chunks of this many dice. Each chunk forms a band of rows of its own.
+ */
+#define CHUNK_DICE 10
+
+
+/**
+ * Maximum number of dice rendered side by side
+ */
+#define MAX_BAND 1024
+
+
+/**
+ * Number of columns taken by a dice face, including the space after it
  */
-const size_t dice_row_len = 16;
+#define FACE_COLUMNS 16
 
 
 /**
- * Variations of lines which occur in a dice
+ * Number of iovecs needed for rendering a chunk of dice
  *
- * A line contains up to three pips, each of which may be represented by one
- * bit. Hence, eight differente variations of a line exist, enumerable via the
- * three bits. However, only a subset of those lines do occur.
+ * A chunk may be preceded by an empty line separating it from the previous
+ * one.
+ */
+#define CHUNK_VECS (D6_RENDER_VECS(CHUNK_DICE) + 1)
+
+
+/**
+ * Maximum number of dice rendered by the benchmark for each method
+ */
+#define BENCH_RENDER_DICE (1 << 22)
+
+
+/**
+ * Ways of rendering dice compared by the benchmark
  */
-char const* dice_parts[] = {
-    "##############  ",
-    "##  ##########  ",
-    "######  ######  ",
-    NULL,
-    "##########  ##  ",
-    "##  ######  ##  "
+enum render_method {
+    RENDER_SINGLE, ///< one iovec per dice and row, `d6_render_rows_single()`
+    RENDER_JOINED, ///< up to three dice per iovec, `d6_render_rows()`
+    RENDER_TEXT, ///< copied into a buffer, `d6_render_text()`
 };
 
 
 /**
- * Get an iovec for a horizontal line of pixels/characters of a dice face
+ * Benchmark rendering dice faces
+ *
+ * Dice are rendered in chunks of `CHUNK_DICE` and written to `/dev/null`. With
+ * iovecs, each chunk is written via `writev()`. Rendered text is collected for
+ * `BENCH_BATCH` dice and written via `write()`.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+bench_render(
+    struct d6* d6, ///< state to roll the dice with
+    unsigned long long count ///< number of dice to render
+) {
+    static char const* const names[] = {"single", "joined", "text"};
+    static uint8_t values[BENCH_BATCH];
+    static char text[
+        D6_RENDER_TEXT_LEN(CHUNK_DICE) * (BENCH_BATCH / CHUNK_DICE + 1)
+    ];
+    struct iovec vecs[7 * (CHUNK_DICE + 1)];
+
+    if (count > BENCH_RENDER_DICE)
+        count = BENCH_RENDER_DICE;
+    if (d6_roll_batch(d6, values, BENCH_BATCH) < 0)
+        return -1;
+
+    int const fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int res = 0;
+    for (int method = RENDER_SINGLE; method <= RENDER_TEXT && res == 0;
+            ++method) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (unsigned long long left = count; left > 0 && res == 0;) {
+            size_t batch = BENCH_BATCH;
+            if (left < batch)
+                batch = left;
+
+            char* pos = text;
+            for (size_t first = 0; first < batch; first += CHUNK_DICE) {
+                unsigned int chunk = CHUNK_DICE;
+                if (batch - first < chunk)
+                    chunk = batch - first;
+
+                if (method == RENDER_TEXT) {
+                    pos += d6_render_text(pos, values + first, chunk);
+                    continue;
+                }
+
+                size_t const vec_count = method == RENDER_SINGLE ?
+                    d6_render_rows_single(vecs, values + first, chunk) :
+                    d6_render_rows(vecs, values + first, chunk);
+                if (writev(fd, vecs, vec_count) < 0)
+                    res = -1;
+            }
+            if (method == RENDER_TEXT && write(fd, text, pos - text) < 0)
+                res = -1;
+
+            left -= batch;
+        }
+
+        double const secs = elapsed(&start);
+        printf("render %s:\n", names[method]);
+        printf("  dice:       %llu\n", count);
+        if (method == RENDER_SINGLE)
+            printf("  iovecs:     %d per chunk of %d dice\n",
+                   7 * (CHUNK_DICE + 1), CHUNK_DICE);
+        if (method == RENDER_JOINED)
+            printf("  iovecs:     %d per chunk of %d dice\n",
+                   D6_RENDER_VECS(CHUNK_DICE), CHUNK_DICE);
+        printf("  time:       %.3f s\n", secs);
+        printf("  throughput: %.1f Mdice/s\n", count / secs * 1e-6);
+    }
+
+    close(fd);
+    return res;
+}
+
+
+/**
+ * Number of dice per pool rolled by the keep benchmark
+ */
+#define BENCH_KEEP_DICE 4
+
+
+/**
+ * Benchmark keeping the highest dice of pools
+ *
+ * Pools of `BENCH_KEEP_DICE` dice are rolled in bulk and all but the lowest
+ * dice of each pool are summed up via `d6_keep_sums()`. The mean of the sums
+ * is reported along with its exact value, computed by enumerating all pools.
+ *
+ * Returns `0` on success, `-1` on error.
  */
-struct iovec
-row_vec(
-    uint8_t row, ///< row of the dice face to write
-    uint8_t value ///< value shown by the dice face
+int
+bench_keep(
+    struct d6* d6, ///< state to roll the dice with
+    unsigned long long count ///< number of dice to roll
 ) {
-    struct iovec retval;
+    static uint8_t values[BENCH_BATCH];
+    static uint16_t sums[BENCH_BATCH / BENCH_KEEP_DICE];
+    unsigned long long const pools = count / BENCH_KEEP_DICE;
+    unsigned long long total = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned long long left = pools; left > 0;) {
+        size_t batch = BENCH_BATCH / BENCH_KEEP_DICE;
+        if (left < batch)
+            batch = left;
+
+        if (d6_roll_batch(d6, values, batch * BENCH_KEEP_DICE) < 0)
+            return -1;
+        d6_keep_sums(values, BENCH_KEEP_DICE, BENCH_KEEP_DICE - 1, 1, sums,
+                     batch);
+        for (size_t pool = 0; pool < batch; ++pool)
+            total += sums[pool];
+
+        left -= batch;
+    }
+
+    double const secs = elapsed(&start);
+
+    unsigned long long exact = 0;
+    unsigned int outcomes = 1;
+    for (int dice = 0; dice < BENCH_KEEP_DICE; ++dice)
+        outcomes *= 6;
+    for (unsigned int outcome = 0; outcome < outcomes; ++outcome) {
+        unsigned int lowest = 6;
+        unsigned int rest = outcome;
+        for (int dice = 0; dice < BENCH_KEEP_DICE; ++dice) {
+            unsigned int const value = rest % 6 + 1;
+            exact += value;
+            if (value < lowest)
+                lowest = value;
+            rest /= 6;
+        }
+        exact -= lowest;
+    }
 
-    uint8_t part = 0;
-    if (row & 1)
-        part = (pips >> (value*9 + 3*(row/2))) & 7;
+    printf("keep %dd6kh%d:\n", BENCH_KEEP_DICE, BENCH_KEEP_DICE - 1);
+    printf("  pools:      %llu\n", pools);
+    printf("  time:       %.3f s\n", secs);
+    printf("  throughput: %.1f Mpools/s\n", pools / secs * 1e-6);
+    if (pools > 0)
+        printf("  mean:       %.4f (exact %.4f)\n", (double) total / pools,
+               (double) exact / outcomes);
+    return 0;
+}
 
-    retval.iov_base = (void*) dice_parts[part];
-    retval.iov_len = dice_row_len;
-    return retval;
+
+/**
+ * Names of the output backends, as accepted by `--output`
+ */
+static char const* const backend_names[] = {
+    [OUTPUT_WRITEV] = "writev",
+    [OUTPUT_VMSPLICE] = "vmsplice",
+    [OUTPUT_URING] = "uring",
+    [OUTPUT_MMAP] = "mmap",
+    [OUTPUT_ZEROCOPY] = "zerocopy",
 };
 
 
-int main(int argc, char* argv[]) {
-    unsigned int count = 1;
-    if (argc > 1)
-        count = atoi(argv[1]);
+/**
+ * Maximum number of dice written through each output backend by the benchmark
+ */
+#define BENCH_OUTPUT_DICE (1 << 22)
 
-    if (count > 10)
-        return 1;
 
-    // a single byte contains enough entropy for 42 dice
-    uint64_t dice_vals;
-    {
-        int rand = open("/dev/random", O_RDONLY);
-        read(rand, &dice_vals, sizeof(dice_vals));
-        close(rand);
+/**
+ * Kinds of files the output benchmark writes to
+ */
+enum bench_sink {
+    SINK_FILE, ///< a temporary regular file
+    SINK_PIPE, ///< a pipe drained into `/dev/null`
+    SINK_SOCKET, ///< a TCP connection via the loopback interface
+};
+
+
+/**
+ * Read everything from a file descriptor and discard it
+ *
+ * The data is spliced to `/dev/null` if possible, which avoids copying it.
+ * The file descriptor is closed once the other end is closed.
+ */
+void*
+drain(
+    void* arg ///< file descriptor to read from, cast to a pointer
+) {
+    static char buf[1 << 20];
+    int const fd = (intptr_t) arg;
+    int const null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    ssize_t res = -1;
+    if (null >= 0) {
+        do {
+            res = splice(fd, NULL, null, NULL, sizeof(buf), 0);
+        } while (res > 0 || (res < 0 && errno == EINTR));
+        close(null);
+    }
+    if (res < 0) {
+        do {
+            res = read(fd, buf, sizeof(buf));
+        } while (res > 0 || (res < 0 && errno == EINTR));
+    }
+
+    close(fd);
+    return NULL;
+}
+
+
+/**
+ * Open a file descriptor for the output benchmark to write to
+ *
+ * For pipes and sockets, a thread draining the other end is started.
+ *
+ * Returns the file descriptor on success, `-1` on error.
+ */
+int
+open_sink(
+    enum bench_sink sink, ///< kind of file to open
+    int file, ///< temporary file used for `SINK_FILE`
+    pthread_t* thread ///< thread draining the other end
+) {
+    int fds[2] = {-1, -1};
+    if (sink == SINK_FILE) {
+        if (ftruncate(file, 0) < 0 || lseek(file, 0, SEEK_SET) < 0)
+            return -1;
+        return dup(file);
+    }
+
+    if (sink == SINK_PIPE) {
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            return -1;
+    } else {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        socklen_t addr_len = sizeof(addr);
+        int const listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0)
+            return -1;
+        if (bind(listener, (struct sockaddr*) &addr, sizeof(addr)) == 0 &&
+                listen(listener, 1) == 0 &&
+                getsockname(listener, (struct sockaddr*) &addr,
+                            &addr_len) == 0) {
+            fds[1] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fds[1] >= 0 &&
+                    connect(fds[1], (struct sockaddr*) &addr, addr_len) == 0)
+                fds[0] = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        }
+        close(listener);
+        if (fds[0] < 0) {
+            if (fds[1] >= 0)
+                close(fds[1]);
+            return -1;
+        }
+    }
+
+    if (pthread_create(thread, NULL, drain, (void*) (intptr_t) fds[0]) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return fds[1];
+}
+
+
+/**
+ * Benchmark the output backends
+ *
+ * Dice faces are rendered once and written repeatedly through every backend
+ * applicable to a temporary file, a pipe and a loopback TCP connection. The
+ * time includes waiting for writes in flight when closing the output.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+bench_output(
+    struct d6* d6, ///< state to roll the dice with
+    unsigned long long count ///< number of dice to write
+) {
+    static char const* const sink_names[] = {"file", "pipe", "socket"};
+    static struct {
+        enum bench_sink sink;
+        enum output_backend backend;
+    } const runs[] = {
+        {SINK_FILE, OUTPUT_WRITEV},
+        {SINK_FILE, OUTPUT_URING},
+        {SINK_FILE, OUTPUT_MMAP},
+        {SINK_PIPE, OUTPUT_WRITEV},
+        {SINK_PIPE, OUTPUT_VMSPLICE},
+        {SINK_SOCKET, OUTPUT_WRITEV},
+        {SINK_SOCKET, OUTPUT_ZEROCOPY},
+    };
+    static uint8_t values[BENCH_BATCH];
+    static char text[
+        D6_RENDER_TEXT_LEN(CHUNK_DICE) * (BENCH_BATCH / CHUNK_DICE + 1)
+    ];
+
+    if (count > BENCH_OUTPUT_DICE)
+        count = BENCH_OUTPUT_DICE;
+    unsigned long long const batches = (count + BENCH_BATCH - 1) / BENCH_BATCH;
+    if (d6_roll_batch(d6, values, BENCH_BATCH) < 0)
+        return -1;
+
+    size_t len = 0;
+    for (size_t first = 0; first < BENCH_BATCH; first += CHUNK_DICE) {
+        unsigned int chunk = CHUNK_DICE;
+        if (BENCH_BATCH - first < chunk)
+            chunk = BENCH_BATCH - first;
+        len += d6_render_text(text + len, values + first, chunk);
+    }
+
+    char const* dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/d6-bench-XXXXXX", dir ? dir : "/tmp");
+    int const file = mkostemp(path, O_CLOEXEC);
+    if (file < 0)
+        return -1;
+    unlink(path);
+
+    int res = 0;
+    for (size_t run = 0; run < sizeof(runs) / sizeof(*runs) && res == 0;
+            ++run) {
+        printf("output %s %s:\n", sink_names[runs[run].sink],
+               backend_names[runs[run].backend]);
+
+        pthread_t thread;
+        int const fd = open_sink(runs[run].sink, file, &thread);
+        if (fd < 0) {
+            res = -1;
+            break;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        struct output out;
+        if (output_init_backend(&out, fd, runs[run].backend) < 0) {
+            printf("  not available\n");
+        } else {
+            for (unsigned long long batch = 0; batch < batches && res == 0;
+                    ++batch)
+                res = output_write(&out, text, len);
+            if (output_close(&out) < 0)
+                res = -1;
+
+            double const secs = elapsed(&start);
+            printf("  dice:       %llu\n", batches * BENCH_BATCH);
+            printf("  time:       %.3f s\n", secs);
+            printf("  throughput: %.1f MiB/s\n",
+                   batches * len / secs / (1 << 20));
+        }
+
+        close(fd);
+        if (runs[run].sink != SINK_FILE)
+            pthread_join(thread, NULL);
     }
 
-    // prepare iovec
-    size_t const vec_count = 7 * (count + 1);
-    struct iovec* vecs = alloca(sizeof(struct iovec) * vec_count);
+    close(file);
+    return res;
+}
+
+
+/**
+ * Number of values per line in numeric output with space separators
+ */
+#define NUMERIC_LINE 32
+
+
+/**
+ * Format dice values as lines of digits
+ *
+ * With a space as separator, a line break is put after every `NUMERIC_LINE`
+ * values and after the last value. `text` must provide space for `2 * count`
+ * characters.
+ *
+ * Returns the number of characters formatted.
+ */
+size_t
+format_numeric(
+    char* text, ///< buffer to format to
+    uint8_t const* values, ///< values to format
+    size_t count, ///< number of values, must not be `0`
+    char sep ///< separator between values
+) {
+    d6_encode_numeric(text, values, count, sep);
+    if (sep != '\n')
+        for (size_t pos = 2 * NUMERIC_LINE - 1; pos < 2 * count;
+                pos += 2 * NUMERIC_LINE)
+            text[pos] = '\n';
+    text[2 * count - 1] = '\n';
+    return 2 * count;
+}
 
-    // put line ends
-    {
-        uint8_t row = 7;
-        while (row-- > 0) {
-            struct iovec* line_end = vecs + (row * (count+1) + count);
-            line_end->iov_base = "\n";
-            line_end->iov_len = 1;
+
+/**
+ * Read a buffer
+ *
+ * In contrast to a plain `read()`, partial reads are continued until either
+ * the buffer is full or the end of the file is reached.
+ *
+ * Returns the number of bytes read or `-1` on error.
+ */
+ssize_t
+read_buf(
+    int fd, ///< file descriptor to read from
+    void* buf, ///< buffer to fill
+    size_t len ///< number of bytes to read
+) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t got = read(fd, (uint8_t*) buf + total, len - total);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
         }
+        if (got == 0)
+            break;
+        total += got;
+    }
+    return total;
+}
+
+
+/**
+ * Number of dice rolled at once in stream mode
+ *
+ * This is a multiple of `CHUNK_DICE`, `D6_FILL_BLOCK_DICE` and `NUMERIC_LINE`.
+ */
+#define STREAM_DICE (100 * D6_FILL_BLOCK_DICE)
+
+
+/**
+ * Output formats
+ */
+enum format {
+    FORMAT_FACES, ///< dice faces
+    FORMAT_NUMERIC, ///< digits
+    FORMAT_BINARY ///< packed binary format
+};
+
+
+/**
+ * State for printing dice
+ */
+struct printer {
+    struct output* out; ///< output to print to
+    enum format format; ///< format to print dice in
+    char sep; ///< separator between values in the numeric format
+    unsigned int band; ///< number of dice faces rendered side by side
+    int started; ///< whether any dice were printed yet
+    int grouped; ///< whether to always collect dice faces in the buffer
+};
+
+
+/**
+ * Determine the number of dice faces fitting side by side
+ *
+ * If `width` is `0`, the width of the terminal `fd` refers to is used. If `fd`
+ * does not refer to a terminal, `CHUNK_DICE` faces are put side by side.
+ *
+ * Returns the number of dice, at least `1` and at most `MAX_BAND`.
+ */
+unsigned int
+layout_band(
+    int fd, ///< file descriptor of the terminal to query
+    unsigned int width ///< width in columns, `0` to query the terminal
+) {
+    if (width == 0) {
+        struct winsize size;
+        if (ioctl(fd, TIOCGWINSZ, &size) < 0 || size.ws_col == 0)
+            return CHUNK_DICE;
+        width = size.ws_col;
+    }
+
+    unsigned int band = width / FACE_COLUMNS;
+    if (band < 1)
+        band = 1;
+    if (band > MAX_BAND)
+        band = MAX_BAND;
+    return band;
+}
+
+
+/**
+ * Begin printing dice
+ *
+ * Prints whatever needs to precede the dice, i.e. the header of the packed
+ * binary format.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_begin(
+    struct printer* printer ///< printer to use
+) {
+    if (printer->format == FORMAT_BINARY)
+        return output_write(printer->out, d6_pack_header, D6_PACK_HEADER_LEN);
+    return 0;
+}
+
+
+/**
+ * Maximum number of dice printed by scattering iovecs
+ *
+ * Writing a few dice faces via `writev()` directly from the templates avoids
+ * copying them. For more dice, copying the faces into the output buffer is
+ * faster than preparing and writing many small iovecs.
+ */
+#define SCATTER_DICE CHUNK_DICE
+
+
+/**
+ * Print dice faces in bands by copying them into the output buffer
+ *
+ * Bands are separated by an empty line.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_faces_text(
+    struct printer* printer, ///< printer to use
+    uint8_t const* values, ///< values of the dice to print
+    size_t count ///< number of dice to print
+) {
+    while (count > 0) {
+        unsigned int chunk = printer->band;
+        if (count < chunk)
+            chunk = count;
+
+        char* const text = output_reserve(
+            printer->out,
+            1 + D6_RENDER_TEXT_LEN(chunk)
+        );
+        if (!text)
+            return -1;
+
+        size_t len = 0;
+        if (printer->started)
+            text[len++] = '\n';
+        len += d6_render_text(text + len, values, chunk);
+        output_commit(printer->out, len);
+
+        printer->started = 1;
+        values += chunk;
+        count -= chunk;
     }
+    return 0;
+}
+
 
-    // prepare
-    for (unsigned int dice_num = 0; dice_num < count; ++dice_num) {
-        uint8_t value = dice_vals % 6 + 1;
-        dice_vals /= 6;
+/**
+ * Print dice faces in bands
+ *
+ * The dice are rendered in bands of the printer's `band` dice, separated by
+ * an empty line. Up to `SCATTER_DICE` dice fitting into a single band are
+ * written directly from the templates if the output does not buffer anyway
+ * and the printer does not group its output. Otherwise, the faces are copied
+ * into the output buffer.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_faces(
+    struct printer* printer, ///< printer to use
+    uint8_t const* values, ///< values of the dice to print
+    size_t count ///< number of dice to print
+) {
+    if (printer->out->backend != OUTPUT_WRITEV || printer->grouped ||
+            count > SCATTER_DICE || count > printer->band)
+        return print_faces_text(printer, values, count);
 
-        uint8_t row = 7;
-        while (row-- > 0)
-            vecs[row * (count+1) + dice_num] = row_vec(row, value);
+    struct iovec vecs[CHUNK_VECS];
+    size_t vec_count = 0;
+    if (printer->started) {
+        vecs[0].iov_base = "\n";
+        vecs[0].iov_len = 1;
+        vec_count = 1;
     }
+    vec_count += d6_render_rows(vecs + vec_count, values, count);
+
+    printer->started = 1;
+    return output_writev(printer->out, vecs, vec_count);
+}
+
+
+/**
+ * Print dice in the packed binary format
+ *
+ * The dice are printed as a single frame.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_binary(
+    struct printer* printer, ///< printer to use
+    uint8_t const* values, ///< values of the dice to print
+    size_t count ///< number of dice to print, at most `STREAM_DICE`
+) {
+    uint8_t* const frame = (uint8_t*) output_reserve(
+        printer->out,
+        4 + d6_packed_len(count)
+    );
+    if (!frame)
+        return -1;
 
-    writev(1, vecs, vec_count);
+    frame[0] = count;
+    frame[1] = count >> 8;
+    frame[2] = count >> 16;
+    frame[3] = count >> 24;
+    output_commit(printer->out, 4 + d6_pack(frame + 4, values, count));
+    return 0;
+}
+
+
+/**
+ * Print dice as digits
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_numeric(
+    struct output* out, ///< output to print to
+    uint8_t const* values, ///< values of the dice to print
+    size_t count, ///< number of dice to print, at most `STREAM_DICE`
+    char sep ///< separator between values
+) {
+    char* const text = output_reserve(out, 2 * count);
+    if (!text)
+        return -1;
 
+    output_commit(out, format_numeric(text, values, count, sep));
     return 0;
 }
 
+
+/**
+ * Print a number of dice
+ *
+ * The dice are printed in pieces of up to `STREAM_DICE` dice. Hence, memory
+ * usage does not depend on the number of dice. In the packed binary format,
+ * each piece forms a frame.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_dice(
+    struct printer* printer, ///< printer to use
+    uint8_t const* values, ///< values of the dice to print
+    size_t count ///< number of dice to print
+) {
+    while (count > 0) {
+        size_t piece = STREAM_DICE;
+        if (count < piece)
+            piece = count;
+
+        int res;
+        switch (printer->format) {
+        case FORMAT_NUMERIC:
+            // `STREAM_DICE` is a multiple of `NUMERIC_LINE`, so lines always
+            // end at the same positions in the buffer
+            res = print_numeric(printer->out, values, piece, printer->sep);
+            break;
+        case FORMAT_BINARY:
+            res = print_binary(printer, values, piece);
+            break;
+        default:
+            res = print_faces(printer, values, piece);
+        }
+        if (res < 0)
+            return -1;
+
+        values += piece;
+        count -= piece;
+    }
+    return 0;
+}
+
+
+/**
+ * Roll and print a number of dice
+ *
+ * The dice are rolled in bulk, reusing the same buffer. Hence, memory usage
+ * does not depend on the number of dice.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+stream_dice(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    unsigned long long count, ///< number of dice to print
+    int unlimited ///< whether to ignore `count` and print dice forever
+) {
+    static uint8_t values[STREAM_DICE];
+
+    if (print_begin(printer) < 0)
+        return -1;
+
+    while (unlimited || count > 0) {
+        size_t fill = STREAM_DICE;
+        if (!unlimited && count < fill)
+            fill = count;
+
+        if (d6_roll_batch(d6, values, fill) < 0)
+            return -1;
+        if (print_dice(printer, values, fill) < 0)
+            return -1;
+
+        if (!unlimited)
+            count -= fill;
+    }
+    return 0;
+}
+
+
+/**
+ * Number of dice rolled at once by a worker thread
+ */
+#define THREAD_CHUNK (16 * STREAM_DICE)
+
+
+/**
+ * Maximum number of worker threads
+ */
+#define MAX_THREADS 256
+
+
+/**
+ * Slot holding the dice of one chunk
+ *
+ * Chunk `n` is placed in slot `n` modulo the number of slots. A slot is ready
+ * once the dice were rolled and is released by the writer once they were
+ * printed.
+ */
+struct slot {
+    uint8_t values[THREAD_CHUNK]; ///< the dice
+    size_t count; ///< number of dice in this chunk
+    unsigned long long chunk; ///< chunk the slot is reserved for
+    int ready; ///< whether the dice of the chunk were rolled
+};
+
+
+/**
+ * State shared by worker threads and the writer
+ */
+struct workers {
+    pthread_mutex_t lock; ///< lock protecting the slots' `chunk` and `ready`
+    pthread_cond_t cond; ///< condition signalled when a slot changes
+    struct slot* slots; ///< slots for chunks
+    unsigned int slot_count; ///< number of slots
+    unsigned int threads; ///< number of worker threads
+    uint64_t position; ///< position of the first dice in seeded mode
+    unsigned long long count; ///< number of dice to roll
+    int unlimited; ///< whether to ignore `count` and roll dice forever
+    int stop; ///< whether the workers should stop
+};
+
+
+/**
+ * Worker thread state
+ */
+struct worker {
+    struct workers* workers; ///< shared state
+    unsigned int index; ///< index of the worker, also its first chunk
+    pthread_t thread; ///< the thread
+    struct d6 d6; ///< state for rolling dice with a private generator
+};
+
+
+/**
+ * Roll chunks of dice in a worker thread
+ *
+ * Worker `i` of `n` rolls chunks `i`, `i + n`, `i + 2n` and so on.
+ */
+void*
+work(
+    void* arg ///< the worker's `struct worker`
+) {
+    struct worker* const worker = arg;
+    struct workers* const workers = worker->workers;
+
+    for (unsigned long long chunk = worker->index; ; chunk += workers->threads) {
+        size_t count = THREAD_CHUNK;
+        if (!workers->unlimited) {
+            unsigned long long const first = chunk * THREAD_CHUNK;
+            if (first >= workers->count)
+                break;
+            if (workers->count - first < count)
+                count = workers->count - first;
+        }
+
+        struct slot* const slot = workers->slots + chunk % workers->slot_count;
+        pthread_mutex_lock(&workers->lock);
+        while (!workers->stop && (slot->chunk != chunk || slot->ready))
+            pthread_cond_wait(&workers->cond, &workers->lock);
+        int const stop = workers->stop;
+        pthread_mutex_unlock(&workers->lock);
+        if (stop)
+            break;
+
+        // rolling with a private generator does not fail
+        if (worker->d6.seeded)
+            d6_seek(&worker->d6, workers->position + chunk * THREAD_CHUNK);
+        d6_roll_batch(&worker->d6, slot->values, count);
+        slot->count = count;
+
+        pthread_mutex_lock(&workers->lock);
+        slot->ready = 1;
+        pthread_cond_broadcast(&workers->cond);
+        pthread_mutex_unlock(&workers->lock);
+    }
+    return NULL;
+}
+
+
+/**
+ * Roll and print a number of dice using multiple threads
+ *
+ * The dice are rolled by worker threads in chunks of `THREAD_CHUNK` dice,
+ * each worker using its own ChaCha20 generator. The chunks are printed in
+ * order by the calling thread. In seeded mode, each worker rolls its chunks
+ * from the positions they take in the stream, which results in the same dice
+ * as rolling them in the calling thread.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+stream_threads(
+    struct d6 const* d6, ///< state the workers' state is derived from
+    struct printer* printer, ///< printer to use
+    unsigned long long count, ///< number of dice to print
+    int unlimited, ///< whether to ignore `count` and print dice forever
+    unsigned int threads ///< number of worker threads
+) {
+    struct workers workers = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .slot_count = 2 * threads,
+        .threads = threads,
+        .position = d6->position,
+        .count = count,
+        .unlimited = unlimited,
+        .stop = 0,
+    };
+
+    workers.slots = calloc(workers.slot_count, sizeof(*workers.slots));
+    struct worker* worker = calloc(threads, sizeof(*worker));
+    int res = -1;
+    if (!workers.slots || !worker)
+        goto out;
+
+    for (unsigned int slot = 0; slot < workers.slot_count; ++slot)
+        workers.slots[slot].chunk = slot;
+
+    for (unsigned int index = 0; index < threads; ++index) {
+        worker[index].workers = &workers;
+        worker[index].index = index;
+        if (d6->seeded) {
+            worker[index].d6 = *d6;
+            worker[index].d6.pool.drbg = &worker[index].d6.drbg;
+        } else if (d6_init_drbg(&worker[index].d6) < 0) {
+            goto out;
+        }
+    }
+
+    res = print_begin(printer);
+    if (res < 0)
+        goto out;
+
+    unsigned int started = 0;
+    for (; started < threads; ++started)
+        if (pthread_create(&worker[started].thread, NULL, work,
+                           worker + started) != 0)
+            break;
+    if (started < threads)
+        res = -1;
+
+    for (unsigned long long chunk = 0; res == 0 && started == threads &&
+            (unlimited || chunk * THREAD_CHUNK < count); ++chunk) {
+        struct slot* const slot = workers.slots + chunk % workers.slot_count;
+        pthread_mutex_lock(&workers.lock);
+        while (slot->chunk != chunk || !slot->ready)
+            pthread_cond_wait(&workers.cond, &workers.lock);
+        pthread_mutex_unlock(&workers.lock);
+
+        res = print_dice(printer, slot->values, slot->count);
+
+        pthread_mutex_lock(&workers.lock);
+        slot->ready = 0;
+        slot->chunk = chunk + workers.slot_count;
+        pthread_cond_broadcast(&workers.cond);
+        pthread_mutex_unlock(&workers.lock);
+    }
+
+    pthread_mutex_lock(&workers.lock);
+    workers.stop = 1;
+    pthread_cond_broadcast(&workers.cond);
+    pthread_mutex_unlock(&workers.lock);
+    while (started-- > 0)
+        pthread_join(worker[started].thread, NULL);
+
+out:
+    free(worker);
+    free(workers.slots);
+    return res;
+}
+
+
+/**
+ * Decode a packed binary stream from stdin as digits
+ *
+ * Returns `0` on success, `-1` on error or if the input is malformed.
+ */
+int
+decode_binary(
+    struct output* out, ///< output to print to
+    char sep ///< separator between values
+) {
+    static uint8_t packed[STREAM_DICE / D6_PACK_BLOCK_DICE * D6_PACK_BLOCK_LEN];
+    static uint8_t values[STREAM_DICE];
+
+    uint8_t header[D6_PACK_HEADER_LEN];
+    if (read_buf(0, header, D6_PACK_HEADER_LEN) != D6_PACK_HEADER_LEN)
+        return -1;
+    if (d6_check_pack_header(header) < 0)
+        return -1;
+
+    for (;;) {
+        uint8_t len[4];
+        ssize_t const got = read_buf(0, len, sizeof(len));
+        if (got == 0)
+            return 0;
+        if (got != sizeof(len))
+            return -1;
+
+        // frames are decoded in pieces of up to `STREAM_DICE` dice, which
+        // always consist of complete blocks except for the last one
+        uint32_t count = len[0] | len[1] << 8 | len[2] << 16 |
+            (uint32_t) len[3] << 24;
+        while (count > 0) {
+            size_t piece = STREAM_DICE;
+            if (count < piece)
+                piece = count;
+
+            ssize_t const packed_bytes = d6_packed_len(piece);
+            if (read_buf(0, packed, packed_bytes) != packed_bytes)
+                return -1;
+            d6_unpack(values, packed, piece);
+            if (print_numeric(out, values, piece, sep) < 0)
+                return -1;
+
+            count -= piece;
+        }
+    }
+}
+
+
+/**
+ * State of a thread rolling dice for a histogram
+ */
+struct counter {
+    pthread_t thread; ///< the thread
+    struct d6* d6; ///< state to roll dice with
+    unsigned long long count; ///< number of dice to roll
+    unsigned long long faces[7]; ///< counts of faces 1 to 6 at 1 to 6
+    int res; ///< result, `0` on success and `-1` on error
+};
+
+
+/**
+ * Roll dice and count the faces
+ */
+void*
+count_faces(
+    void* arg ///< the thread's `struct counter`
+) {
+    struct counter* const counter = arg;
+    uint8_t values[STREAM_DICE];
+
+    counter->res = 0;
+    for (unsigned long long left = counter->count; left > 0;) {
+        size_t batch = STREAM_DICE;
+        if (left < batch)
+            batch = left;
+
+        if (d6_roll_batch(counter->d6, values, batch) < 0) {
+            counter->res = -1;
+            break;
+        }
+        d6_count_faces(counter->faces, values, batch);
+
+        left -= batch;
+    }
+    return NULL;
+}
+
+
+/**
+ * Roll a number of dice and print a histogram of the faces
+ *
+ * Besides the counts and frequencies of each face, a chi-square test for
+ * uniformity and the throughput are reported. With threads, each thread rolls
+ * a share of the dice with its own generator and counts them in a histogram
+ * of its own. The partial histograms are merged at the end. In seeded mode,
+ * the threads roll consecutive shares of the stream, resulting in the same
+ * counts as without threads.
+ *
+ * Returns `0` on success, `-1` if rolling failed or the face counts are too
+ * unlikely (p < 10^-6) for fair dice.
+ */
+int
+histogram(
+    struct d6* d6, ///< state to roll dice with if not using threads
+    unsigned long long count, ///< number of dice to roll
+    unsigned int threads ///< number of threads, `0` for the calling thread only
+) {
+    if (count == 0)
+        return -1;
+
+    unsigned int const counter_count = threads ? threads : 1;
+    struct counter* counter = calloc(counter_count, sizeof(*counter));
+    struct d6* states = calloc(threads, sizeof(*states));
+    int res = -1;
+    if (!counter || (threads && !states))
+        goto out;
+
+    uint64_t position = d6->position;
+    for (unsigned int index = 0; index < counter_count; ++index) {
+        counter[index].count = count / counter_count +
+            (index < count % counter_count);
+        counter[index].d6 = d6;
+        if (threads && d6->seeded) {
+            // each thread takes its share of the stream
+            counter[index].d6 = states + index;
+            states[index] = *d6;
+            states[index].pool.drbg = &states[index].drbg;
+            d6_seek(states + index, position);
+            position += counter[index].count;
+        } else if (threads) {
+            counter[index].d6 = states + index;
+            if (d6_init_drbg(states + index) < 0)
+                goto out;
+        }
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    res = 0;
+    unsigned int started = 0;
+    if (threads) {
+        for (; started < threads; ++started)
+            if (pthread_create(&counter[started].thread, NULL, count_faces,
+                               counter + started) != 0)
+                break;
+        if (started < threads)
+            res = -1;
+        for (unsigned int index = 0; index < started; ++index)
+            pthread_join(counter[index].thread, NULL);
+    } else {
+        count_faces(counter);
+        started = 1;
+    }
+
+    unsigned long long faces[7] = {0};
+    for (unsigned int index = 0; index < started; ++index) {
+        if (counter[index].res < 0)
+            res = -1;
+        for (int face = 1; face <= 6; ++face)
+            faces[face] += counter[index].faces[face];
+    }
+    if (res < 0)
+        goto out;
+
+    double const secs = elapsed(&start);
+    double const stat = chi_square(faces, count);
+    double const p = chi_square_p(stat);
+
+    printf("face  count                 frequency\n");
+    for (int face = 1; face <= 6; ++face)
+        printf("%-4d  %-20llu  %.8f\n", face, faces[face],
+               (double) faces[face] / count);
+    printf("dice:       %llu\n", count);
+    printf("chi-square: %.3f (p = %.4f)\n", stat, p);
+    printf("time:       %.3f s\n", secs);
+    printf("throughput: %.1f Mdice/s\n", count / secs * 1e-6);
+
+    if (p < 1e-6)
+        res = -1;
+
+out:
+    free(states);
+    free(counter);
+    return res;
+}
+
+
+/**
+ * Number of sums drawn at once in sum mode
+ */
+#define SUM_BATCH 4096
+
+
+/**
+ * Format a number as a decimal number followed by a line break
+ *
+ * 20 digits are enough for any 64bit number, i.e. `text` must provide space
+ * for 21 characters.
+ *
+ * Returns the position following the line break.
+ */
+char*
+format_decimal(
+    char* text, ///< buffer to format to
+    uint64_t number ///< number to format
+) {
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+    while (len > 0)
+        *text++ = digits[--len];
+    *text++ = '\n';
+    return text;
+}
+
+
+/**
+ * Print sums as decimal numbers, one per line
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_sums(
+    struct output* out, ///< output to print to
+    uint64_t const* sums, ///< sums to print
+    size_t count ///< number of sums to print, at most `SUM_BATCH`
+) {
+    char* const text = output_reserve(out, 21 * count);
+    if (!text)
+        return -1;
+
+    char* pos = text;
+    for (size_t index = 0; index < count; ++index)
+        pos = format_decimal(pos, sums[index]);
+
+    output_commit(out, pos - text);
+    return 0;
+}
+
+
+/**
+ * Print results of dice expressions as decimal numbers, one per line
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+print_results(
+    struct output* out, ///< output to print to
+    int64_t const* results, ///< results to print
+    size_t count ///< number of results to print, at most `SUM_BATCH`
+) {
+    char* const text = output_reserve(out, 22 * count);
+    if (!text)
+        return -1;
+
+    char* pos = text;
+    for (size_t index = 0; index < count; ++index) {
+        uint64_t magnitude = results[index];
+        if (results[index] < 0) {
+            *pos++ = '-';
+            magnitude = -magnitude;
+        }
+        pos = format_decimal(pos, magnitude);
+    }
+
+    output_commit(out, pos - text);
+    return 0;
+}
+
+
+/**
+ * Roll dice and print only their sums
+ *
+ * If the distribution of the sum is small enough, an alias table is built
+ * from it once and each sum is drawn from it in constant time. Otherwise, the
+ * dice are rolled in bulk and summed up for each sum.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+roll_sums(
+    struct d6* d6, ///< state to roll dice with
+    struct output* out, ///< output to print to
+    unsigned int dice, ///< number of dice to sum up
+    unsigned long long count ///< number of sums to print
+) {
+    static uint64_t sums[SUM_BATCH];
+
+    if (dice < 1)
+        return -1;
+
+    struct d6_dist_cache cache;
+    d6_dist_cache_init(&cache);
+    struct d6_alias alias = {.len = 0};
+    if ((unsigned long long) dice * 5 + 1 <= D6_ALIAS_MAX_LEN) {
+        struct d6_dist const* const dist = d6_dist_get(&cache, dice, 6);
+        int const res = dist ? d6_alias_init(&alias, dist) : -1;
+        // the table is independent from the distribution
+        d6_dist_cache_release(&cache);
+        if (res < 0)
+            return -1;
+    }
+
+    int res = 0;
+    while (count > 0 && res == 0) {
+        size_t batch = SUM_BATCH;
+        if (count < batch)
+            batch = count;
+
+        if (alias.len > 0) {
+            res = d6_alias_sample(&alias, &d6->pool, sums, batch);
+        } else {
+            static uint8_t values[STREAM_DICE];
+            for (size_t index = 0; index < batch && res == 0; ++index) {
+                unsigned long long faces[7] = {0};
+                for (unsigned int left = dice; left > 0 && res == 0;) {
+                    size_t fill = STREAM_DICE;
+                    if (left < fill)
+                        fill = left;
+                    res = d6_roll_batch(d6, values, fill);
+                    if (res == 0)
+                        d6_count_faces(faces, values, fill);
+                    left -= fill;
+                }
+
+                sums[index] = 0;
+                for (int face = 1; face <= 6; ++face)
+                    sums[index] += face * faces[face];
+            }
+        }
+
+        if (res == 0)
+            res = print_sums(out, sums, batch);
+        count -= batch;
+    }
+
+    d6_alias_release(&alias);
+    return res;
+}
+
+
+/**
+ * Evaluate a dice expression and print the results
+ *
+ * The expression is compiled once and evaluated in batches of `SUM_BATCH`.
+ *
+ * Returns `0` on success, `-1` if the expression is invalid or on error.
+ */
+int
+roll_expression(
+    struct d6* d6, ///< state to roll dice with
+    struct output* out, ///< output to print to
+    char const* text, ///< expression to evaluate
+    unsigned long long count ///< number of results to print
+) {
+    static int64_t results[SUM_BATCH];
+
+    struct d6_expr expr;
+    if (d6_expr_compile(&expr, text) < 0)
+        return -1;
+
+    while (count > 0) {
+        size_t batch = SUM_BATCH;
+        if (count < batch)
+            batch = count;
+
+        if (d6_expr_eval(&expr, &d6->pool, results, batch) < 0 ||
+                print_results(out, results, batch) < 0)
+            return -1;
+        count -= batch;
+    }
+    return 0;
+}
+
+
+/**
+ * Maximum number of dice rolled at once with different numbers of sides
+ */
+#define MIXED_DICE 256
+
+
+/**
+ * Roll dice with different numbers of sides and print their faces
+ *
+ * The dice are given as a sum of `NdS` terms, e.g. `d4+2d8+d20`, with dice of
+ * the same kind shown next to each other. The faces are laid out in bands
+ * like those of six-sided dice, and all bands are written at once via a
+ * single gather write, or gathered in the buffer if the printer groups its
+ * output.
+ *
+ * Returns `0` on success, `-1` if the dice are invalid or on error.
+ */
+int
+roll_mixed(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    char const* text ///< dice to roll
+) {
+    static uint8_t values[MIXED_DICE];
+    static uint8_t sides[MIXED_DICE];
+    // each band of `n` dice takes `7 * (n + 1)` iovecs plus a separator
+    static struct iovec vecs[15 * MIXED_DICE];
+
+    struct d6_expr expr;
+    if (d6_expr_compile(&expr, text) < 0 || expr.constant != 0)
+        return -1;
+
+    size_t count = 0;
+    for (unsigned int index = 0; index < expr.count; ++index) {
+        struct d6_expr_term const* term = expr.terms + index;
+        if (term->keep != term->dice || term->explode || term->negate ||
+                term->sides > D6_FACE_MAX_SIDES ||
+                term->dice > MIXED_DICE - count)
+            return -1;
+
+        if (d6_fill_sides(&d6->pool, term->sides, values + count,
+                          term->dice) < 0)
+            return -1;
+        memset(sides + count, term->sides, term->dice);
+        count += term->dice;
+    }
+
+    size_t vec_count = 0;
+    for (size_t first = 0; first < count; first += printer->band) {
+        unsigned int chunk = printer->band;
+        if (count - first < chunk)
+            chunk = count - first;
+
+        if (printer->started) {
+            vecs[vec_count].iov_base = "\n";
+            vecs[vec_count].iov_len = 1;
+            ++vec_count;
+        }
+        vec_count += d6_render_mixed(vecs + vec_count, values + first,
+                                     sides + first, chunk);
+        printer->started = 1;
+    }
+
+    if (printer->grouped)
+        return output_gather(printer->out, vecs, vec_count);
+    return output_writev(printer->out, vecs, vec_count);
+}
+
+
+/**
+ * Size of the buffer for requests in command mode
+ *
+ * This is also the maximum length of a single request.
+ */
+#define COMMAND_BUFFER 65536
+
+
+/**
+ * Maximum number of words of a request in command mode
+ */
+#define COMMAND_WORDS 3
+
+
+/**
+ * Roll and print a number of dice in command mode
+ *
+ * Up to `STREAM_DICE` dice are rolled via `d6_roll()`, more dice in bulk.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+roll_dice(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    unsigned long long count ///< number of dice to roll
+) {
+    static uint8_t values[STREAM_DICE];
+    int const bulk = count > STREAM_DICE;
+
+    while (count > 0) {
+        size_t piece = STREAM_DICE;
+        if (count < piece)
+            piece = count;
+
+        int const res = bulk ?
+            d6_roll_batch(d6, values, piece) :
+            d6_roll(d6, values, piece);
+        if (res < 0 || print_dice(printer, values, piece) < 0)
+            return -1;
+        count -= piece;
+    }
+    return 0;
+}
+
+
+/**
+ * Execute a single request in command mode
+ *
+ * A request consists of words separated by whitespace: either a number of
+ * dice to roll, `roll EXPR [N]` for evaluating a dice expression `N` times or
+ * `dice SPEC` for rolling dice with different numbers of sides. Empty
+ * requests and anything following a `#` are ignored.
+ *
+ * Returns `0` on success, `-1` if the request is invalid or failed.
+ */
+int
+run_command(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    char* line ///< request, which is split into words in place
+) {
+    char* words[COMMAND_WORDS];
+    unsigned int count = 0;
+    for (char* pos = line; *pos != '\0' && *pos != '#';) {
+        if (*pos == ' ' || *pos == '\t' || *pos == '\r') {
+            *pos++ = '\0';
+            continue;
+        }
+        if (count == COMMAND_WORDS)
+            return -1;
+        words[count++] = pos;
+        while (*pos != '\0' && *pos != '#' && *pos != ' ' && *pos != '\t' &&
+                *pos != '\r')
+            ++pos;
+        if (*pos == '#')
+            *pos = '\0';
+    }
+    if (count == 0)
+        return 0;
+
+    char* end;
+    if (strcmp(words[0], "roll") == 0 && count >= 2) {
+        unsigned long long times = 1;
+        if (count == 3) {
+            times = strtoull(words[2], &end, 10);
+            if (*end != '\0' || words[2][0] < '0' || words[2][0] > '9')
+                return -1;
+        }
+        return roll_expression(d6, printer->out, words[1], times);
+    }
+    if (strcmp(words[0], "dice") == 0 && count == 2)
+        return roll_mixed(d6, printer, words[1]);
+
+    unsigned long long const dice = strtoull(words[0], &end, 10);
+    if (count > 1 || *end != '\0' || words[0][0] < '0' || words[0][0] > '9' ||
+            (printer->format == FORMAT_FACES && dice > STREAM_DICE))
+        return -1;
+    return roll_dice(d6, printer, dice);
+}
+
+
+/**
+ * Execute requests read line by line
+ *
+ * Requests are read in blocks of up to `COMMAND_BUFFER` bytes and all
+ * complete ones are executed. The output is flushed only before waiting for
+ * more requests, i.e. the responses to a block of requests are grouped into
+ * as few writes as possible while interactive requests are still answered
+ * right away. Invalid requests are reported and skipped.
+ *
+ * Returns `0` on success, `-1` if any request was invalid or failed.
+ */
+int
+run_commands(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    int fd ///< file descriptor to read requests from
+) {
+    static char buf[COMMAND_BUFFER + 1];
+    size_t len = 0;
+    unsigned long long line = 0;
+    int res = 0;
+
+    printer->grouped = 1;
+    if (print_begin(printer) < 0)
+        return -1;
+
+    for (;;) {
+        if (output_flush(printer->out) < 0)
+            return -1;
+
+        ssize_t const got = read(fd, buf + len, COMMAND_BUFFER - len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0)
+            return -1;
+
+        // the last request need not end with a line break
+        len += got;
+        if (got == 0 && len > 0)
+            buf[len++] = '\n';
+
+        char* start = buf;
+        char* end;
+        while ((end = memchr(start, '\n', buf + len - start))) {
+            *end = '\0';
+            ++line;
+            if (run_command(d6, printer, start) < 0) {
+                fprintf(stderr, "invalid or failed request on line %llu\n",
+                        line);
+                res = -1;
+            }
+            start = end + 1;
+        }
+
+        len -= start - buf;
+        memmove(buf, start, len);
+        if (got == 0)
+            break;
+        if (len == COMMAND_BUFFER) {
+            fprintf(stderr, "request on line %llu too long\n", line + 1);
+            return -1;
+        }
+    }
+    return res;
+}
+
+
+/**
+ * Execute requests from a file
+ *
+ * Requests are read from the standard input if `path` is `-`.
+ *
+ * Returns `0` on success, `-1` if the file could not be read or any request
+ * was invalid or failed.
+ */
+int
+run_file(
+    struct d6* d6, ///< state to roll dice with
+    struct printer* printer, ///< printer to use
+    char const* path ///< path of the file
+) {
+    if (strcmp(path, "-") == 0)
+        return run_commands(d6, printer, 0);
+
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int const res = run_commands(d6, printer, fd);
+    close(fd);
+    return res;
+}
+
+
+/**
+ * Print the exact distribution of the sum of a number of dice
+ *
+ * The dice are given as `NdS`, e.g. `40d6` for 40 six-sided dice. For each
+ * possible sum, its probability and the probabilities of the sum or a lower
+ * one and of the sum or a higher one are printed.
+ *
+ * Returns `0` on success, `-1` if the dice are invalid or the distribution
+ * could not be computed.
+ */
+int
+distribution(
+    char const* spec ///< dice to compute the distribution for
+) {
+    unsigned int dice;
+    unsigned int sides;
+    char trailing;
+    if (sscanf(spec, "%ud%u%c", &dice, &sides, &trailing) != 2)
+        return -1;
+
+    struct d6_dist_cache cache;
+    d6_dist_cache_init(&cache);
+    struct d6_dist const* const dist = d6_dist_get(&cache, dice, sides);
+    if (!dist)
+        return -1;
+
+    printf("sum         P(=)                 P(<=)                P(>=)\n");
+    for (size_t value = 0; value < dist->len; ++value)
+        printf("%-10llu  %-19.12Le  %-19.12Le  %.12Le\n",
+               (unsigned long long) dice + value, dist->pmf[value],
+               dist->cdf[value], dist->sf[value]);
+
+    d6_dist_cache_release(&cache);
+    return 0;
+}
+
+
+/**
+ * Parse a decimal number given on the command line
+ *
+ * Unlike `strtoull()` alone, this rejects signs, leading spaces, trailing
+ * characters and values out of range.
+ *
+ * Returns `0` on success, `-1` if `text` is not a valid number.
+ */
+int
+parse_count(
+    char const* text, ///< text to parse
+    unsigned long long* value ///< parsed number
+) {
+    if (text[0] < '0' || text[0] > '9')
+        return -1;
+
+    char* end;
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+    return *end != '\0' || errno == ERANGE ? -1 : 0;
+}
+
+
+/**
+ * Print a summary of the command line options
+ */
+void
+usage(
+    char const* name ///< name the program was invoked as
+) {
+    fprintf(stderr,
+        "usage: %s [OPTION]... [N]\n"
+        "  --stream [N]          roll N dice, or dice without end, in bands\n"
+        "  --numeric[=lines]     print values as digits, or one per line\n"
+        "  --binary              print values packed in binary\n"
+        "  --decode              decode binary output from stdin\n"
+        "  --threads N           roll dice with N threads\n"
+        "  --width N             print bands N columns wide\n"
+        "  --seed S, --skip N    roll dice reproducibly, starting at dice N\n"
+        "  --prefetch            prefetch random data in the background\n"
+        "  --output BACKEND      writev, vmsplice, uring, mmap or zerocopy\n"
+        "  --animate             animate rolling the dice\n"
+        "  --fps N               animate at N frames per second, up to 1000\n"
+        "  --roll EXPR [N]       evaluate a dice expression N times\n"
+        "  --dice SPEC           roll dice with different numbers of sides\n"
+        "  --sum N               print sums of N dice\n"
+        "  --distribution NdS    print the distribution of the sum of N dice\n"
+        "  --histogram N         count the faces of N dice\n"
+        "  --repl, -f FILE       read requests from stdin or a file\n"
+        "  --serve PATH          answer requests on a Unix domain socket\n"
+        "  --bench [N]           benchmark with N dice\n",
+        name);
+}
+
+
+int main(int argc, char* argv[]) {
+    unsigned long long count = 1;
+    int stream = 0;
+    int unlimited = 0;
+    int bench = 0;
+    int hist = 0;
+    char const* dist = NULL;
+    unsigned int sum_dice = 0;
+    char const* expr = NULL;
+    char const* mixed = NULL;
+    char const* commands = NULL;
+    char const* socket_path = NULL;
+    int prefetching = 0;
+    unsigned int width = 0;
+    int animated = 0;
+    unsigned int fps = ANIMATE_FPS;
+    int seeded = 0;
+    uint64_t seed = 0;
+    uint64_t skip = 0;
+    struct printer printer = {.format = FORMAT_FACES, .sep = ' '};
+    int backend = -1;
+    int decode = 0;
+    unsigned int threads = 0;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--stream") == 0) {
+            // the number of dice is optional in stream mode
+            stream = 1;
+            unlimited = 1;
+            if (arg + 1 < argc && parse_count(argv[arg + 1], &count) == 0) {
+                ++arg;
+                unlimited = 0;
+            }
+        } else if (strcmp(argv[arg], "--numeric") == 0) {
+            printer.format = FORMAT_NUMERIC;
+        } else if (strcmp(argv[arg], "--numeric=lines") == 0) {
+            printer.format = FORMAT_NUMERIC;
+            printer.sep = '\n';
+        } else if (strcmp(argv[arg], "--binary") == 0) {
+            printer.format = FORMAT_BINARY;
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            threads = atoi(argv[++arg]);
+            if (threads < 1 || threads > MAX_THREADS)
+                return 1;
+        } else if (strcmp(argv[arg], "--decode") == 0) {
+            decode = 1;
+        } else if (strcmp(argv[arg], "--histogram") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            hist = 1;
+            count = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--distribution") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            dist = argv[++arg];
+        } else if (strcmp(argv[arg], "--sum") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            sum_dice = atoi(argv[++arg]);
+            if (sum_dice < 1)
+                return 1;
+        } else if (strcmp(argv[arg], "--roll") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            expr = argv[++arg];
+        } else if (strcmp(argv[arg], "--dice") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            mixed = argv[++arg];
+        } else if (strcmp(argv[arg], "--repl") == 0) {
+            commands = "-";
+        } else if (strcmp(argv[arg], "-f") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            commands = argv[++arg];
+        } else if (strcmp(argv[arg], "--serve") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            socket_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--animate") == 0) {
+            animated = 1;
+        } else if (strcmp(argv[arg], "--fps") == 0) {
+            unsigned long long rate;
+            if (arg + 1 >= argc || parse_count(argv[++arg], &rate) < 0 ||
+                    rate < 1 || rate > ANIMATE_MAX_FPS) {
+                usage(argv[0]);
+                return 1;
+            }
+            fps = rate;
+        } else if (strcmp(argv[arg], "--width") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            width = atoi(argv[++arg]);
+            if (width < 1)
+                return 1;
+        } else if (strcmp(argv[arg], "--seed") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            seeded = 1;
+            seed = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--skip") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            skip = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--output") == 0) {
+            if (arg + 1 >= argc)
+                return 1;
+            ++arg;
+            for (backend = OUTPUT_ZEROCOPY; backend >= 0; --backend)
+                if (strcmp(argv[arg], backend_names[backend]) == 0)
+                    break;
+            if (backend < 0)
+                return 1;
+        } else if (strcmp(argv[arg], "--prefetch") == 0) {
+            prefetching = 1;
+        } else if (strcmp(argv[arg], "--bench") == 0) {
+            bench = 1;
+            count = 100000000;
+
+            // the number of dice is optional, so it must not swallow a flag
+            if (arg + 1 < argc && parse_count(argv[arg + 1], &count) == 0)
+                ++arg;
+        } else if (parse_count(argv[arg], &count) < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (dist)
+        return distribution(dist) < 0 ? 1 : 0;
+
+    if (printer.format == FORMAT_FACES && !stream && !bench && !hist &&
+            !threads && !decode && !sum_dice && !expr && !commands &&
+            count > STREAM_DICE)
+        return 1;
+
+    static struct d6 d6;
+    if (seeded) {
+        d6_init_seeded(&d6, seed);
+        d6_seek(&d6, skip);
+    } else {
+        d6_init(&d6);
+    }
+
+    static struct d6_prefetch prefetch;
+    if (prefetching) {
+        if (d6_prefetch_start(&prefetch) < 0)
+            return 1;
+        d6.pool.prefetch = &prefetch;
+    }
+
+    int res;
+    struct output out;
+    if (bench) {
+        res = bench_extraction(&d6, count);
+        if (bench_render(&d6, count) < 0 || bench_keep(&d6, count) < 0 ||
+                bench_output(&d6, count) < 0)
+            res = -1;
+    } else if (hist) {
+        res = histogram(&d6, count, threads);
+    } else if (socket_path) {
+        res = serve(&d6, socket_path);
+    } else if ((backend < 0 ? output_init(&out, 1) :
+                output_init_backend(&out, 1, backend)) < 0) {
+        res = -1;
+    } else {
+        printer.out = &out;
+        printer.band = layout_band(1, width);
+        if (animated) {
+            res = animate(&d6, &out, count, printer.band, fps);
+        } else if (commands) {
+            res = run_file(&d6, &printer, commands);
+        } else if (mixed) {
+            res = roll_mixed(&d6, &printer, mixed);
+        } else if (expr) {
+            res = roll_expression(&d6, &out, expr, count);
+        } else if (sum_dice) {
+            res = roll_sums(&d6, &out, sum_dice, count);
+        } else if (decode) {
+            res = decode_binary(&out, printer.sep);
+        } else if (threads) {
+            res = stream_threads(&d6, &printer, count, unlimited, threads);
+        } else if (printer.format != FORMAT_FACES || stream) {
+            res = stream_dice(&d6, &printer, count, unlimited);
+        } else {
+            static uint8_t values[STREAM_DICE];
+            res = d6_roll(&d6, values, count);
+            if (res == 0)
+                res = print_dice(&printer, values, count);
+        }
+
+        if (output_close(&out) < 0)
+            res = -1;
+    }
+
+    if (prefetching)
+        d6_prefetch_stop(&prefetch);
+    return res < 0 ? 1 : 0;
+}
@@ -0,0 +1,1078 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef D6_H
+#define D6_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+/**
+ * libd6 rolls dice and renders dice faces as text. Each pixel is made up of
+ * two characters. A dice face is rendered using 7x7 pixels, the dice are
+ * separated by one pixel.
+ *
+ * All state is held in explicitly passed structures, e.g. `struct d6`. Only
+ * the distributions of sums allocate memory: `d6_dist_get()` fills the entries
+ * of a `struct d6_dist_cache`, which are freed by `d6_dist_cache_release()`,
+ * and `d6_alias_init()` allocates the tables of a `struct d6_alias`, which are
+ * freed by `d6_alias_release()`. None of the other functions allocates memory.
+ */
+
+
+/**
+ * Size of the entropy pool in bytes
+ */
+#define D6_POOL_SIZE 4096
+
+
+/**
+ * Length of a ChaCha20 block in bytes
+ */
+#define D6_CHACHA_BLOCK_LEN 64
+
+
+/**
+ * ChaCha20 generator
+ *
+ * The generator produces the ChaCha20 key stream for a key and a 64bit nonce,
+ * with a 64bit block counter. Since every block is computed from the key, the
+ * nonce and its counter only, any block of the stream may be computed
+ * directly.
+ */
+struct d6_chacha {
+    uint32_t key[8]; ///< key as little endian words
+    uint64_t nonce; ///< nonce
+    uint64_t counter; ///< counter of the next block to generate
+};
+
+
+/**
+ * Initialize a ChaCha20 generator
+ *
+ * The generator starts at the block with the counter `0`.
+ */
+void
+d6_chacha_init(
+    struct d6_chacha* chacha, ///< generator to initialize
+    uint8_t const* key, ///< key of 32 bytes
+    uint64_t nonce ///< nonce
+);
+
+
+/**
+ * Compute a single block of the key stream
+ *
+ * `out` must provide space for `D6_CHACHA_BLOCK_LEN` bytes.
+ */
+void
+d6_chacha_block(
+    struct d6_chacha const* chacha, ///< generator to use
+    uint64_t counter, ///< counter of the block to compute
+    uint8_t* out ///< buffer to fill
+);
+
+
+/**
+ * Generate key stream
+ *
+ * The key stream is generated in whole blocks starting at the generator's
+ * counter. If `len` is not a multiple of `D6_CHACHA_BLOCK_LEN`, the remainder
+ * of the last block is discarded.
+ */
+void
+d6_chacha_generate(
+    struct d6_chacha* chacha, ///< generator to use
+    void* dest, ///< buffer to fill
+    size_t len ///< number of bytes to generate
+);
+
+
+/**
+ * Number of slots of a prefetch ring
+ */
+#define D6_PREFETCH_SLOTS 64
+
+
+/**
+ * Random data prefetched by a background thread
+ *
+ * A producer thread keeps a ring of `D6_PREFETCH_SLOTS` slots of
+ * `D6_POOL_SIZE` bytes each filled with random data from the kernel. Any
+ * number of consumers may take slots from the ring without locks or system
+ * calls. The producer sleeps while the ring is more than half full.
+ *
+ * Each slot carries a sequence number telling whether it is ready to be
+ * consumed or produced for a given position in the ring.
+ */
+struct d6_prefetch {
+    uint8_t data[D6_PREFETCH_SLOTS][D6_POOL_SIZE]; ///< random data
+    uint64_t seq[D6_PREFETCH_SLOTS]; ///< sequence number of each slot
+    uint64_t head; ///< position of the next slot to consume
+    uint64_t tail; ///< position of the next slot to produce
+    uint32_t wake; ///< futex word for waking the producer
+    int sleeping; ///< whether the producer waits for the ring to drain
+    int stop; ///< whether the producer should stop
+    int error; ///< whether the producer failed to get random data
+    unsigned long long misses; ///< number of reads finding the ring empty
+    pthread_t thread; ///< producer thread
+};
+
+
+/**
+ * Start prefetching random data
+ *
+ * The ring is initialized and the producer thread started. The producer blocks
+ * all signals, so they are delivered to the caller's threads.
+ *
+ * Returns `0` on success, `-1` if the thread could not be started.
+ */
+int
+d6_prefetch_start(
+    struct d6_prefetch* prefetch ///< ring to prefetch into
+);
+
+
+/**
+ * Stop prefetching random data
+ *
+ * The producer thread is stopped and joined. No consumer may read from the
+ * ring afterwards.
+ */
+void
+d6_prefetch_stop(
+    struct d6_prefetch* prefetch ///< ring to stop prefetching into
+);
+
+
+/**
+ * Take a slot of random data from a prefetch ring
+ *
+ * This function never blocks. `dest` must provide space for `D6_POOL_SIZE`
+ * bytes.
+ *
+ * Returns `0` on success, `-1` if the ring is empty.
+ */
+int
+d6_prefetch_read(
+    struct d6_prefetch* prefetch, ///< ring to read from
+    void* dest ///< buffer to fill
+);
+
+
+/**
+ * Buffered random data
+ *
+ * Random data is requested from the kernel in blocks of `D6_POOL_SIZE` bytes
+ * and handed out on demand. The pool is refilled lazily, i.e. only once all of
+ * its data was consumed.
+ *
+ * Alternatively, the pool may draw its data from a ChaCha20 generator seeded
+ * only once, which avoids system calls altogether. Or it may take data from a
+ * prefetch ring, in which case the kernel is only asked directly if the ring
+ * runs empty.
+ */
+struct d6_pool {
+    uint8_t data[D6_POOL_SIZE]; ///< random data
+    size_t pos; ///< offset of the first unused byte in `data`
+    unsigned long long used; ///< number of bytes handed out so far
+    struct d6_chacha* drbg; ///< generator to draw from instead of the kernel
+    struct d6_prefetch* prefetch; ///< ring to draw from before the kernel
+};
+
+
+/**
+ * Initialize an entropy pool
+ *
+ * The pool starts out empty, no random data is requested before the first
+ * read. Random data is drawn from the kernel unless `drbg` or `prefetch` is
+ * set.
+ */
+void
+d6_pool_init(
+    struct d6_pool* pool ///< pool to initialize
+);
+
+
+/**
+ * Read random data from an entropy pool
+ *
+ * The pool is refilled as needed. Whole pools' worth of data of requests
+ * spanning more than an entire pool bypass it, which avoids copying the data.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_pool_read(
+    struct d6_pool* pool, ///< pool to read from
+    void* dest, ///< buffer to fill
+    size_t len ///< number of bytes to read
+);
+
+
+/**
+ * Extractor for dice values
+ *
+ * The extractor maintains a value uniformly distributed in `[0, range)`. A
+ * dice value is extracted by splitting off the value's remainder modulo 6,
+ * which is uniformly distributed and independent from the quotient as long as
+ * the value lies below the greatest multiple of 6 not exceeding `range`.
+ * Otherwise, the value is uniformly distributed over the few values above that
+ * multiple and is kept as a (small) new state rather than being discarded.
+ *
+ * Hence, the dice are exactly uniform and no entropy is thrown away except for
+ * rounding `range` down when extracting a dice. By keeping `range` above 2^32,
+ * the extractor consumes hardly more than log2(6) bits per dice.
+ */
+struct d6_extractor {
+    struct d6_pool* pool; ///< pool to draw random data from
+    uint64_t value; ///< current value, uniformly distributed in `[0, range)`
+    uint64_t range; ///< number of values `value` is distributed over
+};
+
+
+/**
+ * Initialize an extractor
+ */
+void
+d6_extractor_init(
+    struct d6_extractor* extractor, ///< extractor to initialize
+    struct d6_pool* pool ///< pool to draw random data from
+);
+
+
+/**
+ * Roll a number of dice using an extractor
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_extract(
+    struct d6_extractor* extractor, ///< extractor to use
+    uint8_t* values, ///< values to fill
+    size_t count ///< number of dice to roll
+);
+
+
+/**
+ * Number of dice extracted from a block of random words by `d6_fill()`
+ *
+ * A block consists of 16 random 16bit words, each of which yields 3 dice. The
+ * dice are stored in three rows of 16: the first dice of every word, followed
+ * by the second dice of every word and the third dice of every word.
+ */
+#define D6_FILL_BLOCK_DICE 48
+
+
+/**
+ * Roll a number of dice in bulk
+ *
+ * This function is considerably faster than `d6_extract()` but consumes about
+ * 5.3 bits per dice. The dice are extracted in blocks of `D6_FILL_BLOCK_DICE`,
+ * surplus dice of the last block are discarded. The dice are rolled using SSE2
+ * or AVX2 if supported by the CPU.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_fill(
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint8_t* out, ///< dice to fill
+    size_t n ///< number of dice to roll
+);
+
+
+/**
+ * Roll dice deterministically using a counter-based generator
+ *
+ * The dice form a stream determined by the key and nonce of `chacha` alone.
+ * Block `b` of `D6_FILL_BLOCK_DICE` dice of the stream is extracted as by
+ * `d6_fill()` from the first half of the key stream block with the counter
+ * `b`, with replacements for rejected words taken from its second half. Hence,
+ * any dice of the stream may be computed directly, without computing any of
+ * the preceding ones. The generator's `counter` is neither used nor updated.
+ *
+ * Returns `0`.
+ */
+int
+d6_fill_seeded(
+    struct d6_chacha const* chacha, ///< generator to derive the dice from
+    uint64_t first, ///< position of the first dice to roll in the stream
+    uint8_t* out, ///< dice to fill
+    size_t n ///< number of dice to roll
+);
+
+
+/**
+ * Roll a number of dice with any number of sides up to 255 in bulk
+ *
+ * Six-sided dice are rolled via `d6_fill()`. Other dice are split off random
+ * 32bit words by repeated multiplication, as many per word as leave less than
+ * 2^-8 of the words to be rejected for bias.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_fill_sides(
+    struct d6_pool* pool, ///< pool to draw random data from
+    unsigned int sides, ///< number of sides of the dice, at most 255
+    uint8_t* out, ///< dice to fill
+    size_t n ///< number of dice to roll
+);
+
+
+/**
+ * State for rolling dice
+ *
+ * Instances are independent of each other, but not safe for concurrent use.
+ */
+struct d6 {
+    struct d6_pool pool; ///< pool all random data is drawn from
+    struct d6_extractor extractor; ///< extractor for individual rolls
+    struct d6_chacha drbg; ///< generator backing the pool, if used
+    struct d6_chacha stream; ///< generator of the dice in seeded mode
+    uint64_t position; ///< position of the next dice in seeded mode
+    int seeded; ///< whether dice are rolled in seeded mode
+};
+
+
+/**
+ * Initialize state for rolling dice
+ *
+ * Random data is drawn from the kernel.
+ */
+void
+d6_init(
+    struct d6* d6 ///< state to initialize
+);
+
+
+/**
+ * Initialize state for rolling dice with a private generator
+ *
+ * Random data is drawn from a ChaCha20 generator seeded with a random key from
+ * the kernel. Hence, rolling dice does not involve any further system calls.
+ *
+ * Returns `0` on success, `-1` if the generator could not be seeded.
+ */
+int
+d6_init_drbg(
+    struct d6* d6 ///< state to initialize
+);
+
+
+/**
+ * Initialize state for rolling dice reproducibly
+ *
+ * In seeded mode, dice are taken from the stream of `d6_fill_seeded()` for
+ * a generator keyed with the seed, starting at position `0`. Both
+ * `d6_roll()` and `d6_roll_batch()` take the next dice of that stream.
+ * Functions using the pool directly draw from a generator keyed with the seed,
+ * too, but with a different nonce. Seeded mode is meant for reproducing rolls,
+ * not for keeping them secret.
+ */
+void
+d6_init_seeded(
+    struct d6* d6, ///< state to initialize
+    uint64_t seed ///< seed
+);
+
+
+/**
+ * Jump to a position in the stream of dice in seeded mode
+ *
+ * This takes constant time regardless of the position.
+ */
+void
+d6_seek(
+    struct d6* d6, ///< state to use
+    uint64_t position ///< position of the next dice to roll
+);
+
+
+/**
+ * Roll a small number of dice
+ *
+ * The dice are rolled via the extractor, using the random data sparingly. In
+ * seeded mode, the dice are taken from the stream instead.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_roll(
+    struct d6* d6, ///< state to use
+    uint8_t* values, ///< values to fill
+    size_t count ///< number of dice to roll
+);
+
+
+/**
+ * Roll a large number of dice
+ *
+ * The dice are rolled via `d6_fill()`, favouring speed over the use of random
+ * data. In seeded mode, the dice are taken from the stream instead.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_roll_batch(
+    struct d6* d6, ///< state to use
+    uint8_t* values, ///< values to fill
+    size_t count ///< number of dice to roll
+);
+
+
+/**
+ * Count the dice showing each face
+ *
+ * For each face `f` from 1 to 6, `counts[f]` is incremented by the number of
+ * dice showing `f`. Hence, `counts` must hold at least 7 elements. All values
+ * must be in the range 1 to 6, as rolled by `d6_roll()`; the behaviour for
+ * other values is undefined. The dice are counted in parallel in SIMD lanes
+ * where available.
+ */
+void
+d6_count_faces(
+    unsigned long long* counts, ///< counts to increment
+    uint8_t const* values, ///< values of the dice to count
+    size_t count ///< number of dice
+);
+
+
+/**
+ * Maximum number of distinct sums of a distribution
+ */
+#define D6_DIST_MAX_LEN (1 << 24)
+
+
+/**
+ * Distribution of the sum of a number of dice
+ *
+ * The probabilities are indexed by the sum minus the number of dice, i.e. the
+ * minimum sum. They are exact up to the precision of a `long double` unless
+ * the distribution is so large that convolutions are computed via FFT, e.g.
+ * for more than about 6700 d6 or 1700 d20. Then, probabilities below the
+ * precision relative to the most likely sum are set to zero.
+ */
+struct d6_dist {
+    unsigned int dice; ///< number of dice
+    unsigned int sides; ///< number of sides of each dice
+    size_t len; ///< number of distinct sums
+    long double* pmf; ///< probability of each sum
+    long double* cdf; ///< probability of each sum or a lower one
+    long double* sf; ///< probability of each sum or a higher one
+    unsigned long long last_use; ///< time of the last use within the cache
+};
+
+
+/**
+ * Release the memory held by a distribution
+ */
+void
+d6_dist_release(
+    struct d6_dist* dist ///< distribution to release
+);
+
+
+/**
+ * Number of distributions held by a cache
+ */
+#define D6_DIST_CACHE 16
+
+
+/**
+ * Cache of distributions
+ *
+ * Distributions are computed on demand. Once the cache is full, the least
+ * recently used one is replaced.
+ */
+struct d6_dist_cache {
+    struct d6_dist entries[D6_DIST_CACHE]; ///< cached distributions
+    unsigned long long clock; ///< number of lookups so far
+};
+
+
+/**
+ * Initialize an empty cache of distributions
+ */
+void
+d6_dist_cache_init(
+    struct d6_dist_cache* cache ///< cache to initialize
+);
+
+
+/**
+ * Release all distributions held by a cache
+ */
+void
+d6_dist_cache_release(
+    struct d6_dist_cache* cache ///< cache to release
+);
+
+
+/**
+ * Get the distribution of the sum of a number of dice
+ *
+ * The distribution is computed unless it is in the cache already. It remains
+ * valid until it is replaced, i.e. until `D6_DIST_CACHE` other distributions
+ * were retrieved, or until the cache is released.
+ *
+ * Returns the distribution or `NULL` if it is too large or could not be
+ * computed.
+ */
+struct d6_dist const*
+d6_dist_get(
+    struct d6_dist_cache* cache, ///< cache to use
+    unsigned int dice, ///< number of dice
+    unsigned int sides ///< number of sides of each dice
+);
+
+
+/**
+ * Maximum number of distinct sums of an alias table
+ */
+#define D6_ALIAS_MAX_LEN (1 << 20)
+
+
+/**
+ * Alias table for sampling the sum of a number of dice
+ *
+ * A sample is drawn by picking a sum uniformly and, with the probability
+ * `1 - threshold / 2^64`, replacing it by its alias. The probabilities of the
+ * sums are thus represented as multiples of `2^-64 / len`.
+ */
+struct d6_alias {
+    unsigned int dice; ///< number of dice
+    size_t len; ///< number of distinct sums
+    uint64_t* threshold; ///< threshold for keeping a sum rather than its alias
+    uint32_t* alias; ///< alias of each sum, relative to the minimum sum
+};
+
+
+/**
+ * Build an alias table for a distribution
+ *
+ * The table is built using Vose's method in `O(len)`. The distribution must
+ * not have more than `D6_ALIAS_MAX_LEN` distinct sums.
+ *
+ * Returns `0` on success, `-1` if memory could not be allocated.
+ */
+int
+d6_alias_init(
+    struct d6_alias* alias, ///< table to build
+    struct d6_dist const* dist ///< distribution to build the table for
+);
+
+
+/**
+ * Release the memory held by an alias table
+ */
+void
+d6_alias_release(
+    struct d6_alias* alias ///< table to release
+);
+
+
+/**
+ * Draw a number of sums from an alias table
+ *
+ * Each sum is drawn in constant time, regardless of the number of dice.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_alias_sample(
+    struct d6_alias const* alias, ///< table to draw from
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint64_t* sums, ///< sums to fill
+    size_t count ///< number of sums to draw
+);
+
+
+/**
+ * Maximum number of dice per pool for `d6_keep_sums()`
+ */
+#define D6_KEEP_MAX_DICE 16
+
+
+/**
+ * Sum up the highest or lowest dice of a number of pools
+ *
+ * The pools are given as a structure of arrays: `values` holds `dice` rows of
+ * `count` values each, the `i`th dice of pool `p` being `values[i * count +
+ * p]`. Since dice rolled via `d6_fill()` are independent of each other, any
+ * `dice * count` of them may be used as pools this way.
+ *
+ * The rows are sorted by a sorting network, comparing the dice of 16 or 32
+ * pools at once using SSE2 or AVX2 min/max instructions if supported by the
+ * CPU. `dice` must not exceed `D6_KEEP_MAX_DICE`.
+ */
+void
+d6_keep_sums(
+    uint8_t const* values, ///< rows of dice
+    unsigned int dice, ///< number of dice per pool
+    unsigned int keep, ///< number of dice to keep
+    int highest, ///< whether to keep the highest rather than the lowest dice
+    uint16_t* sums, ///< sums of the dice kept in each pool to fill
+    size_t count ///< number of pools
+);
+
+
+/**
+ * Maximum number of terms rolling dice in a dice expression
+ */
+#define D6_EXPR_MAX_TERMS 16
+
+
+/**
+ * Maximum number of sides of the dice in a dice expression
+ */
+#define D6_EXPR_MAX_SIDES 65536
+
+
+/**
+ * Maximum number of dice of a term keeping or dropping dice
+ */
+#define D6_EXPR_MAX_POOL 256
+
+
+/**
+ * Term of a dice expression rolling dice
+ *
+ * The term's value is the sum of the `keep` highest or lowest of its dice. If
+ * the dice explode, each dice showing its highest face is rolled again and the
+ * result added to it, repeatedly.
+ */
+struct d6_expr_term {
+    uint32_t dice; ///< number of dice
+    uint32_t sides; ///< number of sides of each dice
+    uint32_t keep; ///< number of dice kept
+    uint8_t highest; ///< whether the highest rather than the lowest are kept
+    uint8_t explode; ///< whether the dice explode
+    uint8_t negate; ///< whether the term is subtracted rather than added
+};
+
+
+/**
+ * Compiled dice expression
+ *
+ * An expression is a sum of terms, each of which is either a number or dice
+ * in the notation `NdS`, e.g. `2d20+5`. The number of dice `N` may be omitted
+ * if it is `1`. Dice may be followed by `!` for exploding dice and by `khK`
+ * or `klK` for keeping the `K` highest or lowest dice, or by `dhK` or `dlK`
+ * for dropping them, e.g. `4d6kh3`. `kK` and `dK` are short for `khK` and
+ * `dlK`.
+ *
+ * When compiling, all numbers are folded into a single constant and plain
+ * dice with the same number of sides are merged into a single term.
+ */
+struct d6_expr {
+    struct d6_expr_term terms[D6_EXPR_MAX_TERMS]; ///< terms rolling dice
+    unsigned int count; ///< number of terms rolling dice
+    int64_t constant; ///< sum of all numbers
+};
+
+
+/**
+ * Compile a dice expression
+ *
+ * Returns `0` on success, `-1` if the expression is invalid or exceeds any
+ * of the limits.
+ */
+int
+d6_expr_compile(
+    struct d6_expr* expr, ///< expression to compile to
+    char const* text ///< text of the expression
+);
+
+
+/**
+ * Evaluate a dice expression a number of times
+ *
+ * The samples are evaluated in batches, one term at a time. The dice of a
+ * term are rolled for the entire batch at once and summed up in a separate
+ * pass. Six-sided dice are rolled via `d6_fill()`. Dice kept or dropped are
+ * chosen via `d6_keep_sums()` unless they explode or don't fit the limits.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+int
+d6_expr_eval(
+    struct d6_expr const* expr, ///< expression to evaluate
+    struct d6_pool* pool, ///< pool to draw random data from
+    int64_t* results, ///< results to fill
+    size_t count ///< number of times to evaluate the expression
+);
+
+
+/**
+ * Get an iovec for a horizontal line of pixels/characters of a dice face
+ *
+ * The iovec refers to static data and includes the space after the dice.
+ */
+struct iovec
+d6_row_vec(
+    uint8_t row, ///< row of the dice face to write
+    uint8_t value ///< value shown by the dice face
+);
+
+
+/**
+ * Number of iovecs prepared by `d6_render_rows()` for a number of dice
+ */
+#define D6_RENDER_VECS(count) (7 * (((count) + 2) / 3 + 1))
+
+
+/**
+ * Prepare the iovecs rendering a number of dice side by side
+ *
+ * Each of the 7 rows is terminated by a line break. Each iovec covers up to
+ * three dice, referring to static lines with all combinations of dice faces.
+ * `vecs` must provide space for at least `D6_RENDER_VECS(count)` iovecs.
+ *
+ * Returns the number of iovecs prepared.
+ */
+size_t
+d6_render_rows(
+    struct iovec* vecs, ///< iovecs to prepare
+    uint8_t const* values, ///< values of the dice to render
+    unsigned int count ///< number of dice to render
+);
+
+
+/**
+ * Prepare the iovecs rendering a number of dice side by side, one per dice
+ *
+ * This is equivalent to `d6_render_rows()`, but each iovec covers a single
+ * dice. `vecs` must provide space for at least `7 * (count + 1)` iovecs.
+ *
+ * Returns the number of iovecs prepared.
+ */
+size_t
+d6_render_rows_single(
+    struct iovec* vecs, ///< iovecs to prepare
+    uint8_t const* values, ///< values of the dice to render
+    unsigned int count ///< number of dice to render
+);
+
+
+/**
+ * Maximum number of sides of dice whose faces may be rendered
+ *
+ * Dice with up to six sides show pips like a d6, dice with more sides show
+ * their value as a number.
+ */
+#define D6_FACE_MAX_SIDES 99
+
+
+/**
+ * Get an iovec for a row of a face of a dice with any number of sides
+ *
+ * The iovec refers to static data and includes the space after the dice.
+ * `sides` must not exceed `D6_FACE_MAX_SIDES`.
+ */
+struct iovec
+d6_face_vec(
+    uint8_t row, ///< row of the dice face to write
+    uint8_t value, ///< value shown by the dice face
+    uint8_t sides ///< number of sides of the dice
+);
+
+
+/**
+ * Number of iovecs prepared by `d6_render_mixed()` for a number of dice
+ */
+#define D6_RENDER_MIXED_VECS(count) (7 * ((count) + 1))
+
+
+/**
+ * Prepare the iovecs rendering dice with different numbers of sides
+ *
+ * This is equivalent to `d6_render_rows()`, but each dice may have its own
+ * number of sides. Runs of dice showing pips are joined as by
+ * `d6_render_rows()`, each other dice takes one iovec per row. `vecs` must
+ * provide space for at least `D6_RENDER_MIXED_VECS(count)` iovecs.
+ *
+ * Returns the number of iovecs prepared.
+ */
+size_t
+d6_render_mixed(
+    struct iovec* vecs, ///< iovecs to prepare
+    uint8_t const* values, ///< values of the dice to render
+    uint8_t const* sides, ///< number of sides of each dice
+    unsigned int count ///< number of dice to render
+);
+
+
+/**
+ * Length of the text rendered by `d6_render_text()` for a number of dice
+ */
+#define D6_RENDER_TEXT_LEN(count) (7 * (16 * (count) + 1))
+
+
+/**
+ * Render a number of dice side by side into a buffer
+ *
+ * The text is the same as the one referred to by the iovecs prepared by
+ * `d6_render_rows()`. The rows of all six faces are cached in 16 byte blocks,
+ * each of which is copied with a single SSE2 store where available. `text`
+ * must provide space for at least `D6_RENDER_TEXT_LEN(count)` characters.
+ *
+ * Returns the number of characters rendered.
+ */
+size_t
+d6_render_text(
+    char* text, ///< buffer to render to
+    uint8_t const* values, ///< values of the dice to render
+    unsigned int count ///< number of dice to render
+);
+
+
+/**
+ * Encode dice values as digits
+ *
+ * Each value is encoded as a digit followed by the given separator, i.e. `out`
+ * must provide space for `2 * count` characters.
+ */
+void
+d6_encode_numeric(
+    char* out, ///< buffer to encode to
+    uint8_t const* values, ///< values to encode
+    size_t count, ///< number of values
+    char sep ///< separator following each value
+);
+
+
+/**
+ * Packed binary format
+ *
+ * A packed stream starts with a header of `D6_PACK_HEADER_LEN` bytes: the
+ * magic "d6pk", the format version, the number of faces of the dice and two
+ * reserved bytes which are `0`. The header is followed by any number of frames.
+ *
+ * Each frame starts with the number of dice it holds as a 32bit little endian
+ * value, followed by the packed dice. Dice are packed in blocks of
+ * `D6_PACK_BLOCK_DICE` dice. The dice in a block are numbered `0` to `47`, and
+ * the zero based values (i.e. the value shown minus 1) of dice `j`, `16 + j`
+ * and `32 + j` are stored in byte `j` of the block as base-6 digits, least
+ * significant digit first. Hence, the dice of a frame occupy
+ * `D6_PACK_BLOCK_LEN` bytes for each started block, with unused digits of the
+ * last block being `0`.
+ *
+ * Since each byte holds three dice, dice may be accessed at random without
+ * unpacking the entire stream, e.g. via `d6_packed_dice()`.
+ */
+#define D6_PACK_HEADER_LEN 8
+#define D6_PACK_VERSION 1
+#define D6_PACK_BLOCK_DICE 48
+#define D6_PACK_BLOCK_LEN 16
+
+
+/**
+ * Header of packed streams produced by libd6
+ */
+extern uint8_t const d6_pack_header[D6_PACK_HEADER_LEN];
+
+
+/**
+ * Compute the length of a given number of packed dice
+ */
+size_t
+d6_packed_len(
+    size_t count ///< number of dice
+);
+
+
+/**
+ * Check the header of a packed stream
+ *
+ * Returns `0` if the header denotes a stream libd6 can read, `-1` otherwise.
+ */
+int
+d6_check_pack_header(
+    uint8_t const* header ///< header of `D6_PACK_HEADER_LEN` bytes
+);
+
+
+/**
+ * Pack a number of dice
+ *
+ * `out` must provide space for `d6_packed_len(count)` bytes.
+ *
+ * Returns the number of bytes packed.
+ */
+size_t
+d6_pack(
+    uint8_t* out, ///< buffer to pack to
+    uint8_t const* values, ///< values to pack
+    size_t count ///< number of dice
+);
+
+
+/**
+ * Unpack a number of dice
+ *
+ * `packed` must hold `d6_packed_len(count)` bytes.
+ */
+void
+d6_unpack(
+    uint8_t* values, ///< values to unpack to
+    uint8_t const* packed, ///< packed dice
+    size_t count ///< number of dice
+);
+
+
+/**
+ * Retrieve a single dice from packed dice
+ *
+ * Returns the value of the dice with the given index.
+ */
+uint8_t
+d6_packed_dice(
+    uint8_t const* packed, ///< packed dice
+    size_t index ///< index of the dice
+);
+
+
+/**
+ * Length of a request to the daemon in bytes
+ *
+ * A request consists of the number of dice as a 32bit little endian integer,
+ * the number of sides of the dice, the format of the response as one of
+ * `enum d6_serve_format` and two reserved bytes which must be zero.
+ */
+#define D6_SERVE_REQUEST_LEN 8
+
+
+/**
+ * Length of the header of a response from the daemon in bytes
+ *
+ * The header consists of the status as one of `enum d6_serve_status`, the
+ * format of the payload, two reserved bytes and the length of the payload as a
+ * 32bit little endian integer. The payload follows the header directly.
+ */
+#define D6_SERVE_RESPONSE_LEN 8
+
+
+/**
+ * Maximum number of dice per request to the daemon
+ */
+#define D6_SERVE_MAX_DICE 4096
+
+
+/**
+ * Upper bound of the length of the payload of a response in bytes
+ */
+#define D6_SERVE_MAX_PAYLOAD (8 * 16 * D6_SERVE_MAX_DICE)
+
+
+/**
+ * Formats of the payload of a response
+ */
+enum d6_serve_format {
+    D6_SERVE_VALUES, ///< one byte per dice holding its value
+    D6_SERVE_NUMERIC, ///< digits separated by spaces, ending in a line break
+    D6_SERVE_FACES ///< rendered dice faces
+};
+
+
+/**
+ * Status of a response
+ */
+enum d6_serve_status {
+    D6_SERVE_OK, ///< the payload holds the dice requested
+    D6_SERVE_INVALID, ///< the request was invalid, there is no payload
+    D6_SERVE_FAILED ///< the dice could not be rolled, there is no payload
+};
+
+
+/**
+ * Connect to a daemon listening on a Unix domain socket
+ *
+ * Returns the socket or `-1` on error.
+ */
+int
+d6_client_open(
+    char const* path ///< path of the daemon's socket
+);
+
+
+/**
+ * Send a request to a daemon
+ *
+ * Requests may be sent ahead of receiving responses. The daemon responds to
+ * requests in order.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+d6_client_send(
+    int fd, ///< socket connected to the daemon
+    uint32_t count, ///< number of dice to roll
+    uint8_t sides, ///< number of sides of the dice
+    enum d6_serve_format format ///< format of the response
+);
+
+
+/**
+ * Receive a response from a daemon
+ *
+ * If the payload does not fit into the buffer, it is discarded and `errno` is
+ * set to `EMSGSIZE`. If the daemon reports an error, `errno` is set to `EINVAL`
+ * or `EIO`.
+ *
+ * Returns the length of the payload or `-1` on error.
+ */
+ssize_t
+d6_client_recv(
+    int fd, ///< socket connected to the daemon
+    void* buf, ///< buffer to receive the payload in
+    size_t len ///< size of the buffer
+);
+
+
+/**
+ * Roll dice via a daemon
+ *
+ * This sends a request and receives its response.
+ *
+ * Returns the length of the payload or `-1` on error.
+ */
+ssize_t
+d6_client_roll(
+    int fd, ///< socket connected to the daemon
+    uint32_t count, ///< number of dice to roll
+    uint8_t sides, ///< number of sides of the dice
+    enum d6_serve_format format, ///< format of the response
+    void* buf, ///< buffer to receive the payload in
+    size_t len ///< size of the buffer
+);
+
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <complex.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "d6.h"
+
+
+/**
+ * Threshold for convolving via FFT
+ *
+ * Convolutions for which the product of the operands' lengths exceeds this
+ * threshold are computed via FFT rather than directly. Since only the direct
+ * convolution keeps tail probabilities accurate, the threshold is as high as
+ * the time for a convolution permits, a fraction of a second.
+ */
+#define FFT_THRESHOLD (1 << 28)
+
+
+/**
+ * Pi in `long double` precision
+ */
+#define PI 3.141592653589793238462643383279502884L
+
+
+/**
+ * Compute the convolution of two sequences directly
+ *
+ * Since all the values are non-negative, no cancellation occurs and each value
+ * of the result is accurate to a few ulp.
+ */
+static void
+convolve_direct(
+    long double* out, ///< result of `a_len + b_len - 1` values
+    long double const* a, ///< first operand
+    size_t a_len, ///< length of the first operand
+    long double const* b, ///< second operand
+    size_t b_len ///< length of the second operand
+) {
+    for (size_t k = 0; k < a_len + b_len - 1; ++k) {
+        size_t const first = k < b_len ? 0 : k - b_len + 1;
+        size_t const end = k < a_len ? k + 1 : a_len;
+        long double sum0 = 0;
+        long double sum1 = 0;
+        long double sum2 = 0;
+        long double sum3 = 0;
+        size_t i = first;
+        for (; i + 4 <= end; i += 4) {
+            sum0 += a[i] * b[k - i];
+            sum1 += a[i + 1] * b[k - i - 1];
+            sum2 += a[i + 2] * b[k - i - 2];
+            sum3 += a[i + 3] * b[k - i - 3];
+        }
+        for (; i < end; ++i)
+            sum0 += a[i] * b[k - i];
+        out[k] = (sum0 + sum1) + (sum2 + sum3);
+    }
+}
+
+
+/**
+ * Compute the convolution of a sequence with itself directly
+ *
+ * Each product of two different values occurs twice, so only half of them
+ * are computed. Since doubling is exact, the result is as accurate as that of
+ * `convolve_direct()`.
+ */
+static void
+convolve_square(
+    long double* out, ///< result of `2 * len - 1` values
+    long double const* a, ///< operand
+    size_t len ///< length of the operand
+) {
+    for (size_t k = 0; k < 2 * len - 1; ++k) {
+        // products `a[i] * a[k - i]` with `i < k - i`
+        size_t const first = k < len ? 0 : k - len + 1;
+        size_t const end = (k + 1) / 2;
+        long double sum0 = 0;
+        long double sum1 = 0;
+        long double sum2 = 0;
+        long double sum3 = 0;
+        size_t i = first;
+        for (; i + 4 <= end; i += 4) {
+            sum0 += a[i] * a[k - i];
+            sum1 += a[i + 1] * a[k - i - 1];
+            sum2 += a[i + 2] * a[k - i - 2];
+            sum3 += a[i + 3] * a[k - i - 3];
+        }
+        for (; i < end; ++i)
+            sum0 += a[i] * a[k - i];
+
+        out[k] = 2 * ((sum0 + sum1) + (sum2 + sum3));
+        if (k % 2 == 0)
+            out[k] += a[k / 2] * a[k / 2];
+    }
+}
+
+
+/**
+ * Compute a discrete Fourier transform in place
+ *
+ * The length must be a power of two. The twiddle factors are computed directly
+ * for each stage rather than by recurrence, in order to limit the error.
+ */
+static void
+fft(
+    long double complex* data, ///< data to transform
+    size_t len, ///< length of the data
+    int inverse ///< whether to compute the inverse transform (unscaled)
+) {
+    // bit reversal permutation
+    for (size_t i = 1, j = 0; i < len; ++i) {
+        size_t bit = len >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            long double complex const tmp = data[i];
+            data[i] = data[j];
+            data[j] = tmp;
+        }
+    }
+
+    for (size_t half = 1; half < len; half <<= 1) {
+        long double const angle = (inverse ? PI : -PI) / half;
+        for (size_t k = 0; k < half; ++k) {
+            long double complex const twiddle =
+                cosl(angle * k) + I * sinl(angle * k);
+            for (size_t start = 0; start < len; start += 2 * half) {
+                long double complex const even = data[start + k];
+                long double complex const odd = data[start + k + half] * twiddle;
+                data[start + k] = even + odd;
+                data[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+
+/**
+ * Compute the convolution of two sequences via FFT
+ *
+ * The absolute error of each value is in the order of the precision of a
+ * `long double` relative to the largest value. Values below a bound of this
+ * error, `len * LDBL_EPSILON` times the largest value, are set to zero rather
+ * than reporting rounding noise, which includes negative values.
+ *
+ * Returns `0` on success, `-1` if memory could not be allocated.
+ */
+static int
+convolve_fft(
+    long double* out, ///< result of `a_len + b_len - 1` values
+    long double const* a, ///< first operand
+    size_t a_len, ///< length of the first operand
+    long double const* b, ///< second operand
+    size_t b_len ///< length of the second operand
+) {
+    size_t const out_len = a_len + b_len - 1;
+    size_t len = 1;
+    while (len < out_len)
+        len <<= 1;
+
+    long double complex* const fa = calloc(len, sizeof(*fa));
+    long double complex* const fb = calloc(len, sizeof(*fb));
+    if (!fa || !fb) {
+        free(fa);
+        free(fb);
+        return -1;
+    }
+
+    for (size_t i = 0; i < a_len; ++i)
+        fa[i] = a[i];
+    for (size_t i = 0; i < b_len; ++i)
+        fb[i] = b[i];
+
+    fft(fa, len, 0);
+    fft(fb, len, 0);
+    for (size_t i = 0; i < len; ++i)
+        fa[i] *= fb[i];
+    fft(fa, len, 1);
+
+    long double max = 0;
+    for (size_t i = 0; i < out_len; ++i) {
+        out[i] = creall(fa[i]) / len;
+        if (out[i] > max)
+            max = out[i];
+    }
+
+    long double const bound = len * LDBL_EPSILON * max;
+    for (size_t i = 0; i < out_len; ++i)
+        if (out[i] < bound)
+            out[i] = 0;
+
+    free(fa);
+    free(fb);
+    return 0;
+}
+
+
+/**
+ * Compute the convolution of two sequences
+ *
+ * Returns the result of `a_len + b_len - 1` values or `NULL` if memory could
+ * not be allocated.
+ */
+static long double*
+convolve(
+    long double const* a, ///< first operand
+    size_t a_len, ///< length of the first operand
+    long double const* b, ///< second operand
+    size_t b_len ///< length of the second operand
+) {
+    long double* const out = malloc((a_len + b_len - 1) * sizeof(*out));
+    if (!out)
+        return NULL;
+
+    if (a == b && (double) a_len * a_len / 2 <= FFT_THRESHOLD) {
+        convolve_square(out, a, a_len);
+    } else if ((double) a_len * b_len <= FFT_THRESHOLD) {
+        convolve_direct(out, a, a_len, b, b_len);
+    } else if (convolve_fft(out, a, a_len, b, b_len) < 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+
+/**
+ * Compute the distribution of the sum of a number of dice
+ *
+ * The distribution is computed by repeated squaring: the distribution of a
+ * single dice is convolved with itself to get the distributions of 2, 4, 8...
+ * dice, which are combined according to the bits of `dice`.
+ *
+ * Returns `0` on success, `-1` if memory could not be allocated.
+ */
+static int
+compute_dist(
+    struct d6_dist* dist ///< distribution with `dice` and `sides` set
+) {
+    size_t result_len = 1;
+    long double* result = malloc(sizeof(*result));
+    size_t base_len = dist->sides;
+    long double* base = malloc(base_len * sizeof(*base));
+    if (!result || !base)
+        goto fail;
+
+    result[0] = 1;
+    for (size_t value = 0; value < base_len; ++value)
+        base[value] = 1.0L / dist->sides;
+
+    for (unsigned int dice = dist->dice; dice > 0; dice >>= 1) {
+        if (dice & 1) {
+            long double* const next = convolve(result, result_len, base,
+                                               base_len);
+            if (!next)
+                goto fail;
+            free(result);
+            result = next;
+            result_len += base_len - 1;
+        }
+
+        if (dice > 1) {
+            long double* const next = convolve(base, base_len, base, base_len);
+            if (!next)
+                goto fail;
+            free(base);
+            base = next;
+            base_len += base_len - 1;
+        }
+    }
+    free(base);
+
+    dist->pmf = result;
+    dist->cdf = malloc(result_len * sizeof(*dist->cdf));
+    dist->sf = malloc(result_len * sizeof(*dist->sf));
+    if (!dist->cdf || !dist->sf) {
+        d6_dist_release(dist);
+        return -1;
+    }
+
+    // both tails are summed up from their end, which keeps small
+    // probabilities accurate
+    long double sum = 0;
+    for (size_t value = 0; value < result_len; ++value)
+        dist->cdf[value] = sum += result[value];
+    sum = 0;
+    for (size_t value = result_len; value-- > 0;)
+        dist->sf[value] = sum += result[value];
+    return 0;
+
+fail:
+    free(result);
+    free(base);
+    return -1;
+}
+
+
+void
+d6_dist_release(
+    struct d6_dist* dist
+) {
+    free(dist->pmf);
+    free(dist->cdf);
+    free(dist->sf);
+    dist->pmf = NULL;
+    dist->cdf = NULL;
+    dist->sf = NULL;
+}
+
+
+void
+d6_dist_cache_init(
+    struct d6_dist_cache* cache
+) {
+    memset(cache, 0, sizeof(*cache));
+}
+
+
+void
+d6_dist_cache_release(
+    struct d6_dist_cache* cache
+) {
+    for (int entry = 0; entry < D6_DIST_CACHE; ++entry)
+        d6_dist_release(cache->entries + entry);
+}
+
+
+struct d6_dist const*
+d6_dist_get(
+    struct d6_dist_cache* cache,
+    unsigned int dice,
+    unsigned int sides
+) {
+    if (dice < 1 || sides < 1 ||
+            (unsigned long long) dice * (sides - 1) + 1 > D6_DIST_MAX_LEN)
+        return NULL;
+
+    ++cache->clock;
+
+    struct d6_dist* victim = cache->entries;
+    for (int entry = 0; entry < D6_DIST_CACHE; ++entry) {
+        struct d6_dist* const dist = cache->entries + entry;
+        if (dist->pmf && dist->dice == dice && dist->sides == sides) {
+            dist->last_use = cache->clock;
+            return dist;
+        }
+        if (!dist->pmf || (victim->pmf && dist->last_use < victim->last_use))
+            victim = dist;
+    }
+
+    d6_dist_release(victim);
+    victim->dice = dice;
+    victim->sides = sides;
+    victim->len = (size_t) dice * (sides - 1) + 1;
+    victim->last_use = cache->clock;
+    if (compute_dist(victim) < 0)
+        return NULL;
+    return victim;
+}
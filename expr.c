@@ -0,0 +1,591 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "d6.h"
+
+
+/**
+ * Number of samples evaluated at once by `d6_expr_eval()`
+ */
+#define EXPR_BATCH 1024
+
+
+/**
+ * Number of dice rolled at once
+ *
+ * This is a multiple of `D6_FILL_BLOCK_DICE`, i.e. `d6_fill()` does not
+ * discard any dice unless fewer are needed.
+ */
+#define EXPR_CHUNK (42 * D6_FILL_BLOCK_DICE)
+
+
+/**
+ * Skip whitespace
+ *
+ * Returns the first character which is not a space or tab.
+ */
+static char const*
+skip_space(
+    char const* pos ///< position to start at
+) {
+    while (*pos == ' ' || *pos == '\t')
+        ++pos;
+    return pos;
+}
+
+
+/**
+ * Parse a decimal number
+ *
+ * On success, `pos` is advanced past the number.
+ *
+ * Returns `0` on success, `-1` if there are no digits at `pos` or the number
+ * exceeds `limit`.
+ */
+static int
+parse_number(
+    char const** pos, ///< position of the number
+    uint64_t limit, ///< greatest acceptable number, below 2^60
+    uint64_t* value ///< number parsed
+) {
+    char const* text = *pos;
+    if (*text < '0' || *text > '9')
+        return -1;
+
+    uint64_t number = 0;
+    while (*text >= '0' && *text <= '9') {
+        number = 10 * number + (*text++ - '0');
+        if (number > limit)
+            return -1;
+    }
+
+    *pos = text;
+    *value = number;
+    return 0;
+}
+
+
+/**
+ * Parse the part of dice following their number
+ *
+ * `pos` points to the `d` separating the number of dice from the number of
+ * sides and is advanced past the dice on success.
+ *
+ * Returns `0` on success, `-1` if the dice are invalid.
+ */
+static int
+parse_dice(
+    char const** pos, ///< position of the dice
+    struct d6_expr_term* term ///< term to fill in, with `dice` set
+) {
+    uint64_t sides;
+    ++*pos;
+    if (parse_number(pos, D6_EXPR_MAX_SIDES, &sides) < 0 || sides < 1)
+        return -1;
+    term->sides = sides;
+    term->keep = term->dice;
+    term->highest = 1;
+
+    if (**pos == '!') {
+        // dice with a single side would explode forever
+        if (sides < 2)
+            return -1;
+        term->explode = 1;
+        ++*pos;
+    }
+
+    char const op = **pos;
+    if (op != 'k' && op != 'd')
+        return 0;
+    ++*pos;
+
+    // keeping defaults to the highest dice, dropping to the lowest
+    int high = op == 'k';
+    if (**pos == 'h' || **pos == 'l')
+        high = *(*pos)++ == 'h';
+
+    uint64_t number;
+    if (parse_number(pos, term->dice, &number) < 0)
+        return -1;
+    if (op == 'k') {
+        term->keep = number;
+        term->highest = high;
+    } else {
+        term->keep = term->dice - number;
+        term->highest = !high;
+    }
+
+    if (term->keep < term->dice && term->dice > D6_EXPR_MAX_POOL)
+        return -1;
+    return 0;
+}
+
+
+/**
+ * Add a term rolling dice to an expression
+ *
+ * Plain dice are merged into an existing term with the same number of sides
+ * and sign if possible.
+ *
+ * Returns `0` on success, `-1` if the expression has too many terms.
+ */
+static int
+add_term(
+    struct d6_expr* expr, ///< expression to add the term to
+    struct d6_expr_term const* term ///< term to add
+) {
+    if (term->keep == 0)
+        return 0;
+
+    int const plain = term->keep == term->dice && !term->explode;
+    for (unsigned int index = 0; plain && index < expr->count; ++index) {
+        struct d6_expr_term* other = expr->terms + index;
+        if (other->keep == other->dice && !other->explode &&
+                other->sides == term->sides &&
+                other->negate == term->negate &&
+                other->dice <= UINT32_MAX - term->dice) {
+            other->dice += term->dice;
+            other->keep = other->dice;
+            return 0;
+        }
+    }
+
+    if (expr->count >= D6_EXPR_MAX_TERMS)
+        return -1;
+    expr->terms[expr->count++] = *term;
+    return 0;
+}
+
+
+int
+d6_expr_compile(
+    struct d6_expr* expr,
+    char const* text
+) {
+    expr->count = 0;
+    expr->constant = 0;
+
+    char const* pos = skip_space(text);
+    int negate = 0;
+    if (*pos == '+' || *pos == '-') {
+        negate = *pos == '-';
+        pos = skip_space(pos + 1);
+    }
+
+    for (;;) {
+        uint64_t number = 1;
+        if (*pos != 'd' && parse_number(&pos, UINT32_MAX, &number) < 0)
+            return -1;
+
+        if (*pos == 'd') {
+            struct d6_expr_term term = {.dice = number, .negate = negate};
+            if (parse_dice(&pos, &term) < 0 || add_term(expr, &term) < 0)
+                return -1;
+        } else if (negate) {
+            expr->constant -= number;
+        } else {
+            expr->constant += number;
+        }
+
+        pos = skip_space(pos);
+        if (*pos == '\0')
+            return 0;
+        if (*pos != '+' && *pos != '-')
+            return -1;
+        negate = *pos == '-';
+        pos = skip_space(pos + 1);
+    }
+}
+
+
+/**
+ * Upper limit for the number of values a random word is split into
+ *
+ * As many dice are split off each 32bit word as keep the number of their
+ * combinations below this limit. Hence, less than 2^-8 of the words are
+ * rejected.
+ */
+#define SPLIT_RANGE (1 << 24)
+
+
+/**
+ * Maximum number of dice split off a single random word
+ */
+#define SPLIT_MAX_DICE 24
+
+
+/**
+ * Roll a number of dice with any number of sides
+ *
+ * Six-sided dice are rolled via `d6_fill()`. Other dice are split off 32bit
+ * words by repeated multiplication, as many as possible per word, rejecting
+ * the few words which would bias the result. `n` must not exceed
+ * `EXPR_CHUNK`.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+roll_values(
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint32_t sides, ///< number of sides of the dice
+    uint32_t* values, ///< values to fill
+    size_t n ///< number of dice to roll
+) {
+    if (sides == 6) {
+        uint8_t dice[EXPR_CHUNK];
+        if (d6_fill(pool, dice, n) < 0)
+            return -1;
+        for (size_t index = 0; index < n; ++index)
+            values[index] = dice[index];
+        return 0;
+    }
+
+    if (sides == 1) {
+        for (size_t index = 0; index < n; ++index)
+            values[index] = 1;
+        return 0;
+    }
+
+    unsigned int per_word = 1;
+    uint64_t range = sides;
+    while (range * sides <= SPLIT_RANGE) {
+        range *= sides;
+        ++per_word;
+    }
+    uint32_t const reject = (UINT64_C(1) << 32) % range;
+
+    uint32_t words[EXPR_CHUNK];
+    size_t const count = (n + per_word - 1) / per_word;
+    if (d6_pool_read(pool, words, count * sizeof(*words)) < 0)
+        return -1;
+
+    for (size_t index = 0; index < count; ++index) {
+        // the last word may yield more dice than needed
+        uint32_t tail[SPLIT_MAX_DICE];
+        size_t const pos = index * per_word;
+        uint32_t* const dest = n - pos < per_word ? tail : values + pos;
+
+        uint32_t word = words[index];
+        for (;;) {
+            for (unsigned int dice = 0; dice < per_word; ++dice) {
+                uint64_t const product = (uint64_t) word * sides;
+                dest[dice] = (product >> 32) + 1;
+                word = product;
+            }
+            if (word >= reject)
+                break;
+            if (d6_pool_read(pool, &word, sizeof(word)) < 0)
+                return -1;
+        }
+
+        if (dest == tail)
+            for (size_t dice = pos; dice < n; ++dice)
+                values[dice] = tail[dice - pos];
+    }
+    return 0;
+}
+
+
+/**
+ * Roll a number of dice with fewer than 256 sides as bytes
+ *
+ * `n` must not exceed `EXPR_CHUNK`.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+roll_bytes(
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint32_t sides, ///< number of sides of the dice
+    uint8_t* out, ///< dice to fill
+    size_t n ///< number of dice to roll
+) {
+    if (sides == 6)
+        return d6_fill(pool, out, n);
+
+    uint32_t values[EXPR_CHUNK];
+    if (roll_values(pool, sides, values, n) < 0)
+        return -1;
+    for (size_t index = 0; index < n; ++index)
+        out[index] = values[index];
+    return 0;
+}
+
+
+int
+d6_fill_sides(
+    struct d6_pool* pool,
+    unsigned int sides,
+    uint8_t* out,
+    size_t n
+) {
+    while (n > 0) {
+        size_t chunk = EXPR_CHUNK;
+        if (n < chunk)
+            chunk = n;
+        if (roll_bytes(pool, sides, out, chunk) < 0)
+            return -1;
+        out += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+
+/**
+ * Evaluate a term summing up all of its dice for a number of samples
+ *
+ * The dice of all samples are rolled in chunks and summed up sample by sample.
+ * Exploding dice are rolled again in further passes over the samples, each
+ * rolling only the dice which showed their highest face in the previous one.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+eval_sums(
+    struct d6_expr_term const* term, ///< term to evaluate
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint64_t* sums, ///< sums to fill
+    size_t count ///< number of samples, at most `EXPR_BATCH`
+) {
+    uint32_t values[EXPR_CHUNK];
+    uint32_t dice[EXPR_BATCH];
+
+    for (size_t sample = 0; sample < count; ++sample) {
+        dice[sample] = term->dice;
+        sums[sample] = 0;
+    }
+
+    uint64_t total = (uint64_t) term->dice * count;
+    while (total > 0) {
+        uint64_t next_total = 0;
+        size_t avail = 0;
+        size_t pos = 0;
+        for (size_t sample = 0; sample < count; ++sample) {
+            uint32_t maxed = 0;
+            for (uint32_t left = dice[sample]; left > 0;) {
+                if (pos == avail) {
+                    avail = EXPR_CHUNK;
+                    if (total < avail)
+                        avail = total;
+                    if (roll_values(pool, term->sides, values, avail) < 0)
+                        return -1;
+                    total -= avail;
+                    pos = 0;
+                }
+
+                size_t take = avail - pos;
+                if (left < take)
+                    take = left;
+
+                uint64_t sum = 0;
+                for (size_t index = pos; index < pos + take; ++index) {
+                    sum += values[index];
+                    maxed += values[index] == term->sides;
+                }
+                sums[sample] += sum;
+                pos += take;
+                left -= take;
+            }
+
+            dice[sample] = term->explode ? maxed : 0;
+            next_total += dice[sample];
+        }
+        total = next_total;
+    }
+    return 0;
+}
+
+
+/**
+ * Sum up the highest or lowest of a number of values
+ *
+ * The values are sorted in place.
+ *
+ * Returns the sum of the values kept.
+ */
+static uint64_t
+keep_sum(
+    uint32_t* values, ///< values to choose from
+    uint32_t count, ///< number of values
+    uint32_t keep, ///< number of values to keep
+    int highest ///< whether to keep the highest rather than the lowest
+) {
+    for (uint32_t index = 1; index < count; ++index) {
+        uint32_t const value = values[index];
+        uint32_t pos = index;
+        for (; pos > 0 && values[pos - 1] > value; --pos)
+            values[pos] = values[pos - 1];
+        values[pos] = value;
+    }
+
+    if (highest)
+        values += count - keep;
+
+    uint64_t sum = 0;
+    for (uint32_t index = 0; index < keep; ++index)
+        sum += values[index];
+    return sum;
+}
+
+
+/**
+ * Evaluate a term keeping only some of its dice via sorting networks
+ *
+ * The dice of as many samples as fit into a chunk are rolled as bytes and
+ * passed to `d6_keep_sums()` as pools, in multiples of 32 pools where
+ * possible. The dice must not explode.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+eval_networks(
+    struct d6_expr_term const* term, ///< term to evaluate
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint64_t* sums, ///< sums to fill
+    size_t count ///< number of samples
+) {
+    uint8_t values[EXPR_CHUNK];
+    uint16_t kept[EXPR_CHUNK];
+    size_t per_chunk = EXPR_CHUNK / term->dice;
+    if (per_chunk > 32)
+        per_chunk &= ~(size_t) 31;
+
+    for (size_t first = 0; first < count; first += per_chunk) {
+        size_t samples = count - first;
+        if (per_chunk < samples)
+            samples = per_chunk;
+
+        if (roll_bytes(pool, term->sides, values, samples * term->dice) < 0)
+            return -1;
+        d6_keep_sums(values, term->dice, term->keep, term->highest, kept,
+                     samples);
+        for (size_t sample = 0; sample < samples; ++sample)
+            sums[first + sample] = kept[sample];
+    }
+    return 0;
+}
+
+
+/**
+ * Evaluate a term keeping only some of its dice for a number of samples
+ *
+ * The dice of as many samples as fit into a chunk are rolled at once. Dice
+ * which explode are collected and rolled again until none shows its highest
+ * face.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+eval_pools(
+    struct d6_expr_term const* term, ///< term to evaluate
+    struct d6_pool* pool, ///< pool to draw random data from
+    uint64_t* sums, ///< sums to fill
+    size_t count ///< number of samples
+) {
+    uint32_t values[EXPR_CHUNK];
+    uint32_t extra[EXPR_CHUNK];
+    uint32_t exploding[EXPR_CHUNK];
+    size_t const per_chunk = EXPR_CHUNK / term->dice;
+
+    for (size_t first = 0; first < count; first += per_chunk) {
+        size_t samples = count - first;
+        if (per_chunk < samples)
+            samples = per_chunk;
+
+        size_t const n = samples * term->dice;
+        if (roll_values(pool, term->sides, values, n) < 0)
+            return -1;
+
+        size_t pending = 0;
+        if (term->explode) {
+            for (size_t index = 0; index < n; ++index)
+                if (values[index] == term->sides)
+                    exploding[pending++] = index;
+        }
+        while (pending > 0) {
+            if (roll_values(pool, term->sides, extra, pending) < 0)
+                return -1;
+
+            size_t next = 0;
+            for (size_t index = 0; index < pending; ++index) {
+                values[exploding[index]] += extra[index];
+                if (extra[index] == term->sides)
+                    exploding[next++] = exploding[index];
+            }
+            pending = next;
+        }
+
+        for (size_t sample = 0; sample < samples; ++sample)
+            sums[first + sample] = keep_sum(values + sample * term->dice,
+                                            term->dice, term->keep,
+                                            term->highest);
+    }
+    return 0;
+}
+
+
+int
+d6_expr_eval(
+    struct d6_expr const* expr,
+    struct d6_pool* pool,
+    int64_t* results,
+    size_t count
+) {
+    uint64_t sums[EXPR_BATCH];
+
+    while (count > 0) {
+        size_t batch = EXPR_BATCH;
+        if (count < batch)
+            batch = count;
+
+        for (size_t sample = 0; sample < batch; ++sample)
+            results[sample] = expr->constant;
+
+        for (unsigned int index = 0; index < expr->count; ++index) {
+            struct d6_expr_term const* term = expr->terms + index;
+            int res;
+            if (term->keep == term->dice)
+                res = eval_sums(term, pool, sums, batch);
+            else if (!term->explode && term->sides < 256 &&
+                    term->dice <= D6_KEEP_MAX_DICE)
+                res = eval_networks(term, pool, sums, batch);
+            else
+                res = eval_pools(term, pool, sums, batch);
+            if (res < 0)
+                return -1;
+
+            if (term->negate) {
+                for (size_t sample = 0; sample < batch; ++sample)
+                    results[sample] -= sums[sample];
+            } else {
+                for (size_t sample = 0; sample < batch; ++sample)
+                    results[sample] += sums[sample];
+            }
+        }
+
+        results += batch;
+        count -= batch;
+    }
+    return 0;
+}
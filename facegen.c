@@ -0,0 +1,85 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "d6.h"
+
+
+/**
+ * Generator for the faces of dice showing numbers
+ *
+ * Dice with more than six sides show their value as a number rather than as
+ * pips. This program generates a header holding the rows of all such faces
+ * from a template, so they may be referred to directly when rendering.
+ */
+
+
+/**
+ * Template of a face showing a number
+ *
+ * The marker `@@` is replaced by the value, right aligned. Like the rows of
+ * pips, each row includes the space after the dice.
+ */
+static char const* const face_template[7] = {
+    "##############  ",
+    "####      ####  ",
+    "##          ##  ",
+    "##    @@    ##  ",
+    "##          ##  ",
+    "####      ####  ",
+    "##############  ",
+};
+
+
+int main(void) {
+    printf("/* generated by facegen, do not edit */\n\n");
+    printf("/**\n");
+    printf(" * Rows of faces showing numbers\n");
+    printf(" *\n");
+    printf(" * Row `r` of the face showing `v` is found at"
+           " `numeric_faces[v - 1][r]`.\n");
+    printf(" */\n");
+    printf("static char const numeric_faces[%d][7][16]"
+           " __attribute__((aligned(16))) = {\n", D6_FACE_MAX_SIDES);
+
+    for (int value = 1; value <= D6_FACE_MAX_SIDES; ++value) {
+        char number[3];
+        snprintf(number, sizeof(number), "%2d", value);
+
+        printf("    {\n");
+        for (int row = 0; row < 7; ++row) {
+            char line[17];
+            strcpy(line, face_template[row]);
+            char* const marker = strstr(line, "@@");
+            if (marker)
+                memcpy(marker, number, 2);
+            printf("        \"%s\",\n", line);
+        }
+        printf("    },\n");
+    }
+
+    printf("};\n");
+    return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,421 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "d6.h"
+#include "simd.h"
+
+
+/**
+ * Number of random words in a block processed by `d6_fill()`
+ */
+#define FILL_BLOCK_WORDS 16
+
+
+/**
+ * Number of blocks for which random words are retrieved at once
+ */
+#define FILL_BATCH 128
+
+
+/**
+ * Lower limit for the remainder of an accepted random word
+ *
+ * 3 dice are extracted from a 16bit word by multiplying by 6 and splitting off
+ * the upper 16 bits three times. The results are uniformly distributed if we
+ * reject words leaving a final remainder below 2^16 mod 6^3.
+ */
+#define FILL_THRESHOLD (65536 % 216)
+
+
+/**
+ * Kernel extracting dice from blocks of random words
+ *
+ * A kernel extracts `D6_FILL_BLOCK_DICE` dice from each block of
+ * `FILL_BLOCK_WORDS` words. For each block, it sets a mask with one bit for
+ * every word rejected. The dice derived from rejected words are garbage.
+ */
+typedef void fill_kernel(
+    uint8_t* out, ///< dice to fill
+    uint16_t const* words, ///< random words
+    size_t blocks, ///< number of blocks to process
+    uint16_t* rejects ///< masks of rejected words to fill
+);
+
+
+/**
+ * Extract three dice from a single random word
+ *
+ * The dice are stored at `out[0]`, `out[16]` and `out[32]`.
+ *
+ * Returns whether the word was accepted.
+ */
+static int
+split_word(
+    uint8_t* out, ///< location of the first dice
+    uint16_t word ///< random word
+) {
+    uint32_t prod = (uint32_t) word * 6;
+    out[0] = (prod >> 16) + 1;
+    prod = (prod & 0xffff) * 6;
+    out[16] = (prod >> 16) + 1;
+    prod = (prod & 0xffff) * 6;
+    out[32] = (prod >> 16) + 1;
+    return (prod & 0xffff) >= FILL_THRESHOLD;
+}
+
+
+/**
+ * Portable kernel extracting dice from random words
+ */
+static void
+fill_scalar(
+    uint8_t* out,
+    uint16_t const* words,
+    size_t blocks,
+    uint16_t* rejects
+) {
+    while (blocks-- > 0) {
+        uint16_t mask = 0;
+        for (int word = 0; word < FILL_BLOCK_WORDS; ++word)
+            if (!split_word(out + word, words[word]))
+                mask |= 1 << word;
+
+        *rejects++ = mask;
+        out += D6_FILL_BLOCK_DICE;
+        words += FILL_BLOCK_WORDS;
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Kernel extracting dice from random words using SSE2
+ *
+ * Each block is processed in two halves of 8 words.
+ */
+__attribute__((target("sse2")))
+static void
+fill_sse2(
+    uint8_t* out,
+    uint16_t const* words,
+    size_t blocks,
+    uint16_t* rejects
+) {
+    __m128i const six = _mm_set1_epi16(6);
+    __m128i const one = _mm_set1_epi8(1);
+    __m128i const threshold = _mm_set1_epi16(FILL_THRESHOLD);
+    __m128i const zero = _mm_setzero_si128();
+
+    while (blocks-- > 0) {
+        __m128i dice[2][3];
+        int accepted = 0;
+        for (int half = 0; half < 2; ++half) {
+            __m128i rem = _mm_loadu_si128((__m128i const*) words + half);
+            for (int row = 0; row < 3; ++row) {
+                dice[half][row] = _mm_mulhi_epu16(rem, six);
+                rem = _mm_mullo_epi16(rem, six);
+            }
+
+            // lanes with a remainder of at least the threshold are accepted
+            __m128i const ok = _mm_cmpeq_epi16(
+                _mm_subs_epu16(threshold, rem),
+                zero
+            );
+            accepted |= _mm_movemask_epi8(
+                _mm_packs_epi16(ok, zero)
+            ) << (8 * half);
+        }
+
+        for (int row = 0; row < 3; ++row) {
+            __m128i const packed = _mm_packus_epi16(dice[0][row], dice[1][row]);
+            _mm_storeu_si128(
+                (__m128i*) (out + 16 * row),
+                _mm_add_epi8(packed, one)
+            );
+        }
+
+        *rejects++ = ~accepted;
+        out += D6_FILL_BLOCK_DICE;
+        words += FILL_BLOCK_WORDS;
+    }
+}
+
+
+/**
+ * Kernel extracting dice from random words using AVX2
+ *
+ * Each block is processed as a whole. Since AVX2 packs within 128bit lanes,
+ * the packed dice need to be permuted before being stored.
+ */
+__attribute__((target("avx2")))
+static void
+fill_avx2(
+    uint8_t* out,
+    uint16_t const* words,
+    size_t blocks,
+    uint16_t* rejects
+) {
+    __m256i const six = _mm256_set1_epi16(6);
+    __m256i const one = _mm256_set1_epi8(1);
+    __m256i const threshold = _mm256_set1_epi16(FILL_THRESHOLD);
+
+    while (blocks-- > 0) {
+        __m256i rem = _mm256_loadu_si256((__m256i const*) words);
+        __m256i dice[3];
+        for (int row = 0; row < 3; ++row) {
+            dice[row] = _mm256_mulhi_epu16(rem, six);
+            rem = _mm256_mullo_epi16(rem, six);
+        }
+
+        // lanes with a remainder of at least the threshold are accepted
+        __m256i const ok = _mm256_cmpeq_epi16(
+            _mm256_max_epu16(rem, threshold),
+            rem
+        );
+        __m256i const ok_bytes = _mm256_permute4x64_epi64(
+            _mm256_packs_epi16(ok, ok),
+            0xd8
+        );
+        uint16_t const accepted = _mm256_movemask_epi8(ok_bytes);
+
+        // rows 0 and 1 as well as row 2 (twice) end up in 64bit quarters
+        // 0, 2 and 1, 3 respectively
+        __m256i const first = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(dice[0], dice[1]),
+            0xd8
+        );
+        __m256i const second = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(dice[2], dice[2]),
+            0xd8
+        );
+        _mm256_storeu_si256((__m256i*) out, _mm256_add_epi8(first, one));
+        _mm_storeu_si128(
+            (__m128i*) (out + 32),
+            _mm256_castsi256_si128(_mm256_add_epi8(second, one))
+        );
+
+        *rejects++ = ~accepted;
+        out += D6_FILL_BLOCK_DICE;
+        words += FILL_BLOCK_WORDS;
+    }
+}
+#endif
+
+
+/**
+ * Get the fastest kernel supported by the CPU
+ */
+static fill_kernel*
+get_fill_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        return fill_avx2;
+    case SIMD_SSE2:
+        return fill_sse2;
+    default:
+        break;
+    }
+#endif
+    return fill_scalar;
+}
+
+
+/**
+ * Extract dice from blocks of random words, replacing rejected words
+ *
+ * Replacements for rejected words are drawn from the pool in the order of the
+ * words. Hence, the result does not depend on the kernel used.
+ *
+ * Returns `0` on success, `-1` if no random data could be retrieved.
+ */
+static int
+fill_blocks(
+    struct d6_pool* pool, ///< pool to draw replacements from
+    uint8_t* out, ///< dice to fill
+    uint16_t const* words, ///< random words
+    size_t blocks ///< number of blocks to process
+) {
+    uint16_t rejects[FILL_BATCH];
+    get_fill_kernel()(out, words, blocks, rejects);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        for (uint16_t mask = rejects[block]; mask != 0; mask &= mask - 1) {
+            uint8_t* const dice = out + block * D6_FILL_BLOCK_DICE +
+                __builtin_ctz(mask);
+            uint16_t word;
+            do {
+                if (d6_pool_read(pool, &word, sizeof(word)) < 0)
+                    return -1;
+            } while (!split_word(dice, word));
+        }
+    }
+    return 0;
+}
+
+
+int
+d6_fill(
+    struct d6_pool* pool,
+    uint8_t* out,
+    size_t n
+) {
+    uint16_t words[FILL_BATCH * FILL_BLOCK_WORDS];
+
+    while (n >= D6_FILL_BLOCK_DICE) {
+        size_t blocks = n / D6_FILL_BLOCK_DICE;
+        if (blocks > FILL_BATCH)
+            blocks = FILL_BATCH;
+
+        if (d6_pool_read(pool, words, blocks * sizeof(words[0]) *
+                FILL_BLOCK_WORDS) < 0)
+            return -1;
+        if (fill_blocks(pool, out, words, blocks) < 0)
+            return -1;
+
+        out += blocks * D6_FILL_BLOCK_DICE;
+        n -= blocks * D6_FILL_BLOCK_DICE;
+    }
+
+    if (n > 0) {
+        uint8_t tail[D6_FILL_BLOCK_DICE];
+        if (d6_pool_read(pool, words, sizeof(words[0]) * FILL_BLOCK_WORDS) < 0)
+            return -1;
+        if (fill_blocks(pool, tail, words, 1) < 0)
+            return -1;
+        memcpy(out, tail, n);
+    }
+    return 0;
+}
+
+
+/**
+ * Flag distinguishing the nonces of the overflow streams of `d6_fill_seeded()`
+ */
+#define SEEDED_OVERFLOW ((uint64_t) 1 << 63)
+
+
+/**
+ * Load a little endian 16bit word
+ */
+static uint16_t
+load_le16(
+    uint8_t const* bytes ///< bytes to load
+) {
+    return bytes[0] | bytes[1] << 8;
+}
+
+
+/**
+ * Replace the rejected words of a block in seeded mode
+ *
+ * Replacements are taken from the second half of the block's key stream block
+ * in the order of the words. Should these run out, replacements are taken from
+ * the key stream blocks with the same counter of the overflow streams, i.e.
+ * streams with the nonce flagged with `SEEDED_OVERFLOW`.
+ */
+static void
+replace_seeded(
+    struct d6_chacha const* chacha, ///< generator of the dice
+    uint64_t block, ///< counter of the block
+    uint8_t* dice, ///< dice of the block
+    uint16_t rejects, ///< mask of rejected words
+    uint8_t const* spare ///< second half of the key stream block
+) {
+    uint8_t overflow_block[D6_CHACHA_BLOCK_LEN];
+    struct d6_chacha overflow = *chacha;
+    uint64_t round = 0;
+    size_t pos = 0;
+    size_t len = D6_CHACHA_BLOCK_LEN / 2;
+
+    for (; rejects != 0; rejects &= rejects - 1) {
+        uint8_t* const out = dice + __builtin_ctz(rejects);
+        uint16_t word;
+        do {
+            if (pos == len) {
+                overflow.nonce = chacha->nonce ^ (SEEDED_OVERFLOW | round++);
+                d6_chacha_block(&overflow, block, overflow_block);
+                spare = overflow_block;
+                pos = 0;
+                len = D6_CHACHA_BLOCK_LEN;
+            }
+            word = load_le16(spare + pos);
+            pos += 2;
+        } while (!split_word(out, word));
+    }
+}
+
+
+int
+d6_fill_seeded(
+    struct d6_chacha const* chacha,
+    uint64_t first,
+    uint8_t* out,
+    size_t n
+) {
+    uint8_t stream[FILL_BATCH][D6_CHACHA_BLOCK_LEN];
+    uint16_t words[FILL_BATCH * FILL_BLOCK_WORDS];
+    uint8_t dice[FILL_BATCH * D6_FILL_BLOCK_DICE];
+    uint16_t rejects[FILL_BATCH];
+
+    uint64_t block = first / D6_FILL_BLOCK_DICE;
+    size_t skip = first % D6_FILL_BLOCK_DICE;
+    while (n > 0) {
+        size_t blocks = (skip + n + D6_FILL_BLOCK_DICE - 1) /
+            D6_FILL_BLOCK_DICE;
+        if (blocks > FILL_BATCH)
+            blocks = FILL_BATCH;
+
+        for (size_t index = 0; index < blocks; ++index) {
+            d6_chacha_block(chacha, block + index, stream[index]);
+            for (int word = 0; word < FILL_BLOCK_WORDS; ++word)
+                words[index * FILL_BLOCK_WORDS + word] =
+                    load_le16(stream[index] + 2 * word);
+        }
+
+        get_fill_kernel()(dice, words, blocks, rejects);
+        for (size_t index = 0; index < blocks; ++index)
+            if (rejects[index])
+                replace_seeded(chacha, block + index,
+                               dice + index * D6_FILL_BLOCK_DICE,
+                               rejects[index],
+                               stream[index] + D6_CHACHA_BLOCK_LEN / 2);
+
+        size_t take = blocks * D6_FILL_BLOCK_DICE - skip;
+        if (take > n)
+            take = n;
+        memcpy(out, dice + skip, take);
+
+        out += take;
+        n -= take;
+        block += blocks;
+        skip = 0;
+    }
+    return 0;
+}
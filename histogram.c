@@ -0,0 +1,76 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "d6.h"
+
+
+void
+d6_count_faces(
+    unsigned long long* counts,
+    uint8_t const* values,
+    size_t count
+) {
+#ifdef __SSE2__
+    __m128i const zero = _mm_setzero_si128();
+
+    // the byte counters of each lane overflow after 255 rounds at the latest
+    while (count >= 16) {
+        size_t rounds = count / 16;
+        if (rounds > 255)
+            rounds = 255;
+
+        __m128i lanes[5];
+        for (int face = 0; face < 5; ++face)
+            lanes[face] = zero;
+
+        for (size_t round = 0; round < rounds; ++round) {
+            __m128i const dice = _mm_loadu_si128((__m128i const*) values);
+            for (int face = 0; face < 5; ++face)
+                lanes[face] = _mm_sub_epi8(
+                    lanes[face],
+                    _mm_cmpeq_epi8(dice, _mm_set1_epi8(face + 1))
+                );
+            values += 16;
+        }
+
+        // faces 1 to 5 are counted, the rest shows a 6
+        unsigned long long rest = 16 * rounds;
+        for (int face = 0; face < 5; ++face) {
+            __m128i const sums = _mm_sad_epu8(lanes[face], zero);
+            unsigned long long const sum = _mm_cvtsi128_si32(sums) +
+                _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+            counts[face + 1] += sum;
+            rest -= sum;
+        }
+        counts[6] += rest;
+
+        count -= 16 * rounds;
+    }
+#endif
+    while (count-- > 0)
+        ++counts[*values++];
+}
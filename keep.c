@@ -0,0 +1,268 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "d6.h"
+#include "simd.h"
+
+
+/**
+ * Maximum number of comparators of a sorting network
+ */
+#define NETWORK_MAX_LEN 63
+
+
+/**
+ * Sorting network
+ *
+ * Each comparator is a pair of rows, the lower and the higher of which
+ * receive the lower and higher value respectively.
+ */
+struct network {
+    uint8_t pairs[NETWORK_MAX_LEN][2]; ///< comparators
+    unsigned int len; ///< number of comparators
+    unsigned int first; ///< first row to sum up after sorting
+    unsigned int last; ///< row following the last one to sum up
+};
+
+
+/**
+ * Kernel summing up the dice kept in a number of pools
+ *
+ * A kernel processes as many pools as fit its vectors entirely.
+ *
+ * Returns the number of pools processed.
+ */
+typedef size_t keep_kernel(
+    uint8_t const* values, ///< rows of dice
+    size_t stride, ///< length of a row
+    unsigned int dice, ///< number of dice per pool
+    struct network const* network, ///< network to sort the dice with
+    uint16_t* sums, ///< sums to fill
+    size_t count ///< number of pools
+);
+
+
+/**
+ * Build a sorting network for a number of rows
+ *
+ * The network is Batcher's odd-even merge sort for the smallest power of two
+ * of rows not below `dice`, with all comparators involving rows beyond `dice`
+ * removed. This is equivalent to sorting the dice together with surplus rows
+ * holding values above any dice, which such comparators would never move.
+ */
+static void
+build_network(
+    struct network* network, ///< network to build
+    unsigned int dice ///< number of rows to sort
+) {
+    unsigned int inputs = 1;
+    while (inputs < dice)
+        inputs <<= 1;
+
+    network->len = 0;
+    for (unsigned int p = 1; p < inputs; p <<= 1)
+        for (unsigned int k = p; k >= 1; k >>= 1)
+            for (unsigned int j = k % p; j + k < inputs; j += 2 * k)
+                for (unsigned int i = 0; i < k && i + j + k < inputs; ++i) {
+                    unsigned int const low = i + j;
+                    unsigned int const high = i + j + k;
+                    if (low / (2 * p) != high / (2 * p) || high >= dice)
+                        continue;
+                    network->pairs[network->len][0] = low;
+                    network->pairs[network->len][1] = high;
+                    ++network->len;
+                }
+}
+
+
+/**
+ * Portable kernel summing up the dice kept in a number of pools
+ */
+static size_t
+keep_scalar(
+    uint8_t const* values,
+    size_t stride,
+    unsigned int dice,
+    struct network const* network,
+    uint16_t* sums,
+    size_t count
+) {
+    for (size_t pool = 0; pool < count; ++pool) {
+        uint8_t rows[D6_KEEP_MAX_DICE];
+        for (unsigned int row = 0; row < dice; ++row)
+            rows[row] = values[row * stride + pool];
+
+        for (unsigned int index = 0; index < network->len; ++index) {
+            uint8_t const low = rows[network->pairs[index][0]];
+            uint8_t const high = rows[network->pairs[index][1]];
+            rows[network->pairs[index][0]] = low < high ? low : high;
+            rows[network->pairs[index][1]] = low < high ? high : low;
+        }
+
+        uint16_t sum = 0;
+        for (unsigned int row = network->first; row < network->last; ++row)
+            sum += rows[row];
+        sums[pool] = sum;
+    }
+    return count;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Kernel summing up the dice kept in a number of pools using SSE2
+ *
+ * 16 pools are processed at once.
+ */
+__attribute__((target("sse2")))
+static size_t
+keep_sse2(
+    uint8_t const* values,
+    size_t stride,
+    unsigned int dice,
+    struct network const* network,
+    uint16_t* sums,
+    size_t count
+) {
+    __m128i const zero = _mm_setzero_si128();
+
+    size_t pool = 0;
+    for (; pool + 16 <= count; pool += 16) {
+        __m128i rows[D6_KEEP_MAX_DICE];
+        for (unsigned int row = 0; row < dice; ++row)
+            rows[row] = _mm_loadu_si128(
+                (__m128i const*) (values + row * stride + pool)
+            );
+
+        for (unsigned int index = 0; index < network->len; ++index) {
+            __m128i const low = rows[network->pairs[index][0]];
+            __m128i const high = rows[network->pairs[index][1]];
+            rows[network->pairs[index][0]] = _mm_min_epu8(low, high);
+            rows[network->pairs[index][1]] = _mm_max_epu8(low, high);
+        }
+
+        __m128i lower = zero;
+        __m128i upper = zero;
+        for (unsigned int row = network->first; row < network->last; ++row) {
+            lower = _mm_add_epi16(lower, _mm_unpacklo_epi8(rows[row], zero));
+            upper = _mm_add_epi16(upper, _mm_unpackhi_epi8(rows[row], zero));
+        }
+        _mm_storeu_si128((__m128i*) (sums + pool), lower);
+        _mm_storeu_si128((__m128i*) (sums + pool + 8), upper);
+    }
+    return pool;
+}
+
+
+/**
+ * Kernel summing up the dice kept in a number of pools using AVX2
+ *
+ * 32 pools are processed at once.
+ */
+__attribute__((target("avx2")))
+static size_t
+keep_avx2(
+    uint8_t const* values,
+    size_t stride,
+    unsigned int dice,
+    struct network const* network,
+    uint16_t* sums,
+    size_t count
+) {
+    size_t pool = 0;
+    for (; pool + 32 <= count; pool += 32) {
+        __m256i rows[D6_KEEP_MAX_DICE];
+        for (unsigned int row = 0; row < dice; ++row)
+            rows[row] = _mm256_loadu_si256(
+                (__m256i const*) (values + row * stride + pool)
+            );
+
+        for (unsigned int index = 0; index < network->len; ++index) {
+            __m256i const low = rows[network->pairs[index][0]];
+            __m256i const high = rows[network->pairs[index][1]];
+            rows[network->pairs[index][0]] = _mm256_min_epu8(low, high);
+            rows[network->pairs[index][1]] = _mm256_max_epu8(low, high);
+        }
+
+        // widening each 128bit half keeps the pools in order
+        __m256i lower = _mm256_setzero_si256();
+        __m256i upper = _mm256_setzero_si256();
+        for (unsigned int row = network->first; row < network->last; ++row) {
+            lower = _mm256_add_epi16(lower, _mm256_cvtepu8_epi16(
+                _mm256_castsi256_si128(rows[row])
+            ));
+            upper = _mm256_add_epi16(upper, _mm256_cvtepu8_epi16(
+                _mm256_extracti128_si256(rows[row], 1)
+            ));
+        }
+        _mm256_storeu_si256((__m256i*) (sums + pool), lower);
+        _mm256_storeu_si256((__m256i*) (sums + pool + 16), upper);
+    }
+    return pool;
+}
+#endif
+
+
+/**
+ * Get the fastest kernel supported by the CPU
+ */
+static keep_kernel*
+get_keep_kernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        return keep_avx2;
+    case SIMD_SSE2:
+        return keep_sse2;
+    default:
+        break;
+    }
+#endif
+    return keep_scalar;
+}
+
+
+void
+d6_keep_sums(
+    uint8_t const* values,
+    unsigned int dice,
+    unsigned int keep,
+    int highest,
+    uint16_t* sums,
+    size_t count
+) {
+    struct network network;
+    build_network(&network, dice);
+    network.first = highest ? dice - keep : 0;
+    network.last = highest ? dice : keep;
+
+    // pools not filling an entire vector are left to the portable kernel
+    size_t const done = get_keep_kernel()(values, count, dice, &network, sums,
+                                          count);
+    keep_scalar(values + done, count, dice, &network, sums + done,
+                count - done);
+}
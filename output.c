@@ -0,0 +1,823 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "uring.h"
+
+
+/**
+ * Step in which the mmap backend grows files ahead of the data written
+ */
+#define MMAP_GROW (64 << 20)
+
+
+/**
+ * Write out all the data referred to by a number of iovecs
+ *
+ * In contrast to a plain `writev()`, partial writes are continued and any
+ * number of iovecs may be written. The iovecs are modified in the process.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+write_vecs(
+    int fd, ///< file descriptor to write to
+    struct iovec* vecs, ///< iovecs to write
+    size_t count ///< number of iovecs
+) {
+    while (count > 0) {
+        // writev() refuses more than `IOV_MAX` iovecs at once
+        ssize_t written = writev(fd, vecs, count < IOV_MAX ? count : IOV_MAX);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // skip all the data written
+        while (count > 0 && (size_t) written >= vecs->iov_len) {
+            written -= vecs->iov_len;
+            ++vecs;
+            --count;
+        }
+        if (count > 0) {
+            vecs->iov_base = (char*) vecs->iov_base + written;
+            vecs->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Write out a buffer
+ *
+ * In contrast to a plain `write()`, partial writes are continued.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+write_buf(
+    int fd, ///< file descriptor to write to
+    void const* buf, ///< data to write
+    size_t len ///< number of bytes to write
+) {
+    struct iovec vec = {.iov_base = (void*) buf, .iov_len = len};
+    return write_vecs(fd, &vec, 1);
+}
+
+
+/**
+ * Drop the pages of a buffer gifted to a pipe
+ *
+ * Hence, we never modify them again, even though the pipe's reader may still
+ * be using them or may have moved them elsewhere, e.g. into the page cache.
+ * The buffer is backed by fresh pages afterwards.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+release_pages(
+    char* buf, ///< page aligned buffer to release
+    size_t len ///< number of bytes in the buffer
+) {
+    size_t const page = sysconf(_SC_PAGESIZE);
+    size_t const pages_len = (len + page - 1) / page * page;
+    if (madvise(buf, pages_len, MADV_DONTNEED) < 0)
+        return -1;
+#ifdef MADV_POPULATE_WRITE
+    // faulting in the fresh pages at once is cheaper than one by one, but
+    // only an optimization
+    madvise(buf, pages_len, MADV_POPULATE_WRITE);
+#endif
+    return 0;
+}
+
+
+/**
+ * Gift a buffer to a pipe
+ *
+ * The buffer's pages are handed to the pipe via `vmsplice()` and released via
+ * `release_pages()` afterwards. On error, the pages are kept, since the rest of
+ * the buffer may still have to be written some other way.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+splice_buf(
+    int fd, ///< pipe to write to
+    char* buf, ///< page aligned buffer to gift
+    size_t len, ///< number of bytes in the buffer
+    size_t* spliced_len ///< number of bytes gifted, even on error
+) {
+    struct iovec vec = {.iov_base = buf, .iov_len = len};
+    while (vec.iov_len > 0) {
+        ssize_t spliced = vmsplice(fd, &vec, 1, SPLICE_F_GIFT);
+        if (spliced < 0) {
+            if (errno == EINTR)
+                continue;
+            *spliced_len = len - vec.iov_len;
+            return -1;
+        }
+        vec.iov_base = (char*) vec.iov_base + spliced;
+        vec.iov_len -= spliced;
+    }
+
+    *spliced_len = len;
+    return release_pages(buf, len);
+}
+
+
+/**
+ * Write out a buffer at a given offset
+ *
+ * In contrast to a plain `pwrite()`, partial writes are continued.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+pwrite_buf(
+    int fd, ///< file descriptor to write to
+    char const* buf, ///< data to write
+    size_t len, ///< number of bytes to write
+    off_t offset ///< offset in the file to write to
+) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, buf, len, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+
+/**
+ * Replace the output's buffer by a region of `OUTPUT_DEPTH` buffers
+ *
+ * None of the buffers is in flight, the first one is filled next.
+ */
+static void
+use_region(
+    struct output* out, ///< output to switch to the region
+    char* region ///< region of `OUTPUT_DEPTH * OUTPUT_BUFFER` bytes
+) {
+    munmap(out->region, out->region_len);
+    out->region = region;
+    out->region_len = OUTPUT_DEPTH * OUTPUT_BUFFER;
+    out->buf = region;
+    out->current = 0;
+    for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf)
+        out->inflight[buf].busy = 0;
+}
+
+
+#ifdef HAVE_IO_URING
+/**
+ * Set up the io_uring backend
+ *
+ * All buffers are registered with the ring, which saves the kernel from
+ * mapping them for every single write.
+ *
+ * Returns `0` on success, `-1` if io_uring can't be used for the output.
+ */
+static int
+uring_setup(
+    struct output* out ///< output to set up
+) {
+    int const flags = fcntl(out->fd, F_GETFL);
+    if (flags < 0 || flags & O_APPEND)
+        return -1;
+
+    out->offset = lseek(out->fd, 0, SEEK_CUR);
+    if (out->offset < 0)
+        return -1;
+
+    size_t const region_len = OUTPUT_DEPTH * OUTPUT_BUFFER;
+    char* const region = mmap(NULL, region_len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return -1;
+
+    struct iovec bufs[OUTPUT_DEPTH];
+    for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf) {
+        bufs[buf].iov_base = region + buf * OUTPUT_BUFFER;
+        bufs[buf].iov_len = OUTPUT_BUFFER;
+    }
+
+    out->ring = uring_open(OUTPUT_DEPTH, bufs, OUTPUT_DEPTH);
+    if (!out->ring) {
+        munmap(region, region_len);
+        return -1;
+    }
+
+    use_region(out, region);
+    return 0;
+}
+
+
+/**
+ * Wait for the completion of one write in flight
+ *
+ * Short writes are completed synchronously.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+uring_reap(
+    struct output* out ///< output to wait for
+) {
+    uint64_t buf;
+    int32_t res;
+    if (uring_wait(out->ring, &buf, &res) < 0)
+        return -1;
+
+    struct output_inflight* const inflight = out->inflight + buf;
+    inflight->busy = 0;
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    if ((size_t) res < inflight->len)
+        return pwrite_buf(out->fd, out->region + buf * OUTPUT_BUFFER + res,
+                          inflight->len - res, inflight->offset + res);
+    return 0;
+}
+
+
+/**
+ * Submit the buffer being filled and switch to the next one
+ *
+ * The next buffer may only be filled once its previous write completed. In
+ * the meantime, the buffers just submitted are written.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+uring_flush(
+    struct output* out, ///< output to flush
+    size_t len ///< number of bytes in the buffer
+) {
+    struct output_inflight* const inflight = out->inflight + out->current;
+    inflight->len = len;
+    inflight->offset = out->offset;
+    inflight->busy = 1;
+    if (uring_write_fixed(out->ring, out->fd, out->buf, len, out->offset,
+                          out->current, out->current) < 0) {
+        inflight->busy = 0;
+        return -1;
+    }
+    out->offset += len;
+
+    out->current = (out->current + 1) % OUTPUT_DEPTH;
+    out->buf = out->region + out->current * OUTPUT_BUFFER;
+    while (out->inflight[out->current].busy)
+        if (uring_reap(out) < 0)
+            return -1;
+    return 0;
+}
+
+
+/**
+ * Wait for all writes in flight and tear down the io_uring backend
+ *
+ * The file offset is moved past the data written, just as if it had been
+ * written synchronously.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+uring_teardown(
+    struct output* out ///< output to tear down
+) {
+    int res = 0;
+    for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf)
+        while (out->inflight[buf].busy)
+            if (uring_reap(out) < 0) {
+                // there is no telling what is in flight anymore
+                res = -1;
+                break;
+            }
+
+    if (lseek(out->fd, out->offset, SEEK_SET) < 0)
+        res = -1;
+    uring_close(out->ring);
+    return res;
+}
+#endif
+
+
+/**
+ * Map the window of the file starting at the output's offset
+ *
+ * The window spans `OUTPUT_BUFFER` bytes from the offset on and starts at a
+ * page boundary. The file is grown ahead in steps of `MMAP_GROW` bytes, which
+ * also makes sure the space is actually available rather than running into
+ * `SIGBUS` on a full disk. The previous window is unmapped.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+mmap_window(
+    struct output* out ///< output to map the window for
+) {
+    size_t const page = sysconf(_SC_PAGESIZE);
+    off_t const base = out->offset / page * page;
+    size_t const len = OUTPUT_BUFFER + page;
+
+    off_t const end = base + len;
+    if (out->grown < end) {
+        off_t const grown = (end + MMAP_GROW - 1) / MMAP_GROW * MMAP_GROW;
+        if (fallocate(out->map_fd, 0, out->grown, grown - out->grown) < 0 &&
+                (errno != EOPNOTSUPP || ftruncate(out->map_fd, grown) < 0))
+            return -1;
+        out->grown = grown;
+    }
+
+    char* const window = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                              out->map_fd, base);
+    if (window == MAP_FAILED)
+        return -1;
+
+    munmap(out->region, out->region_len);
+    out->region = window;
+    out->region_len = len;
+    out->buf = window + (out->offset - base);
+    return 0;
+}
+
+
+/**
+ * Set up the mmap backend
+ *
+ * Since a file can't be mapped for writing only, it is opened again for
+ * reading and writing via procfs.
+ *
+ * Returns `0` on success, `-1` if the file can't be mapped.
+ */
+static int
+mmap_setup(
+    struct output* out ///< output to set up
+) {
+    struct stat st;
+    int const flags = fcntl(out->fd, F_GETFL);
+    if (flags < 0 || flags & O_APPEND || fstat(out->fd, &st) < 0 ||
+            !S_ISREG(st.st_mode))
+        return -1;
+
+    out->offset = lseek(out->fd, 0, SEEK_CUR);
+    if (out->offset < 0)
+        return -1;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", out->fd);
+    out->map_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (out->map_fd < 0)
+        return -1;
+
+    struct stat map_st;
+    out->size = st.st_size;
+    out->grown = st.st_size;
+    if (fstat(out->map_fd, &map_st) < 0 || map_st.st_dev != st.st_dev ||
+            map_st.st_ino != st.st_ino || mmap_window(out) < 0) {
+        close(out->map_fd);
+        out->map_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Tear down the mmap backend
+ *
+ * The file is cut back to the end of the data written, unless it was larger
+ * to begin with, and the file offset is moved past the data.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+mmap_teardown(
+    struct output* out ///< output to tear down
+) {
+    int res = 0;
+    off_t const end = out->offset > out->size ? out->offset : out->size;
+    if (ftruncate(out->map_fd, end) < 0 ||
+            lseek(out->fd, out->offset, SEEK_SET) < 0)
+        res = -1;
+    close(out->map_fd);
+    return res;
+}
+
+
+/**
+ * Set up the zerocopy backend
+ *
+ * Returns `0` on success, `-1` if zerocopy sends are not supported for the
+ * output, e.g. because it is not a TCP or UDP socket.
+ */
+static int
+zerocopy_setup(
+    struct output* out ///< output to set up
+) {
+    int const one = 1;
+    if (setsockopt(out->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+        return -1;
+
+    char* const region = mmap(NULL, OUTPUT_DEPTH * OUTPUT_BUFFER,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return -1;
+
+    use_region(out, region);
+    for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf)
+        out->inflight[buf].pending = 0;
+    out->sends = 0;
+    out->copied = 0;
+    return 0;
+}
+
+
+/**
+ * Wait for completions of zerocopy sends
+ *
+ * The kernel numbers zerocopy sends consecutively and reports ranges of
+ * completed ones on the socket's error queue. A buffer is in flight until all
+ * of its sends completed.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+zerocopy_reap(
+    struct output* out ///< output to wait for
+) {
+    struct pollfd poll_fd = {.fd = out->fd};
+    if (poll(&poll_fd, 1, -1) < 0)
+        return errno == EINTR ? 0 : -1;
+
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in6))];
+    struct msghdr msg = {.msg_control = control,
+                         .msg_controllen = sizeof(control)};
+    if (recvmsg(out->fd, &msg, MSG_ERRQUEUE) < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            return -1;
+        // nothing left to complete the sends if the peer is gone
+        if (poll_fd.revents & POLLHUP) {
+            errno = EPIPE;
+            return -1;
+        }
+        return 0;
+    }
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR))
+            continue;
+
+        struct sock_extended_err const* const err =
+            (struct sock_extended_err const*) CMSG_DATA(cmsg);
+        if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            continue;
+        if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            out->copied = 1;
+
+        // sends `ee_info` to `ee_data` completed
+        for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf) {
+            struct output_inflight* const inflight = out->inflight + buf;
+            if (!inflight->busy)
+                continue;
+
+            uint64_t const first = inflight->first_send;
+            uint64_t const last = first + inflight->sends;
+            uint64_t const low = err->ee_info > first ? err->ee_info : first;
+            uint64_t const high = (uint64_t) err->ee_data + 1 < last ?
+                (uint64_t) err->ee_data + 1 : last;
+            if (low < high)
+                inflight->pending -= high - low;
+            inflight->busy = inflight->pending > 0;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Send the buffer being filled and switch to the next one
+ *
+ * The buffer is sent with `MSG_ZEROCOPY`, i.e. the kernel refers to its pages
+ * until the data was transmitted. If the kernel refuses to pin any more pages,
+ * the data is copied instead. The same goes for all sends once the kernel
+ * reported copying the data anyway, e.g. for the loopback interface, since
+ * waiting for completions only adds overhead then. The next buffer may only
+ * be filled once all of its previous sends completed.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+zerocopy_flush(
+    struct output* out, ///< output to flush
+    size_t len ///< number of bytes in the buffer
+) {
+    struct output_inflight* const inflight = out->inflight + out->current;
+    inflight->first_send = out->sends;
+    inflight->sends = 0;
+    inflight->pending = 0;
+
+    int const flags = out->copied ? 0 : MSG_ZEROCOPY;
+    char const* pos = out->buf;
+    while (len > 0) {
+        ssize_t sent = send(out->fd, pos, len, flags);
+        if (sent >= 0 && flags) {
+            ++out->sends;
+            ++inflight->sends;
+            ++inflight->pending;
+        } else if (sent < 0 && errno == ENOBUFS) {
+            sent = send(out->fd, pos, len, 0);
+        }
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += sent;
+        len -= sent;
+    }
+    inflight->busy = inflight->pending > 0;
+
+    out->current = (out->current + 1) % OUTPUT_DEPTH;
+    out->buf = out->region + out->current * OUTPUT_BUFFER;
+    while (out->inflight[out->current].busy)
+        if (zerocopy_reap(out) < 0)
+            return -1;
+    return 0;
+}
+
+
+/**
+ * Wait for all zerocopy sends in flight
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+zerocopy_teardown(
+    struct output* out ///< output to tear down
+) {
+    for (unsigned int buf = 0; buf < OUTPUT_DEPTH; ++buf)
+        while (out->inflight[buf].busy)
+            if (zerocopy_reap(out) < 0)
+                return -1;
+    return 0;
+}
+
+
+int
+output_init(
+    struct output* out,
+    int fd
+) {
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        if (S_ISFIFO(st.st_mode))
+            return output_init_backend(out, fd, OUTPUT_VMSPLICE);
+#ifdef HAVE_IO_URING
+        if (S_ISREG(st.st_mode) &&
+                output_init_backend(out, fd, OUTPUT_URING) == 0)
+            return 0;
+#endif
+        if (S_ISSOCK(st.st_mode) &&
+                output_init_backend(out, fd, OUTPUT_ZEROCOPY) == 0)
+            return 0;
+    }
+    return output_init_backend(out, fd, OUTPUT_WRITEV);
+}
+
+
+int
+output_init_backend(
+    struct output* out,
+    int fd,
+    enum output_backend backend
+) {
+    out->fd = fd;
+    out->backend = OUTPUT_WRITEV;
+    out->len = 0;
+    out->ring = NULL;
+    out->map_fd = -1;
+
+    out->region_len = OUTPUT_BUFFER;
+    out->region = mmap(NULL, out->region_len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (out->region == MAP_FAILED)
+        return -1;
+    out->buf = out->region;
+
+    struct stat st;
+    int res = 0;
+    switch (backend) {
+    case OUTPUT_VMSPLICE:
+        if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+            res = -1;
+            break;
+        }
+
+        // a larger pipe saves us from being woken up for every few pages,
+        // but failing to enlarge it is no reason to give up
+        fcntl(fd, F_SETPIPE_SZ, OUTPUT_BUFFER);
+        break;
+    case OUTPUT_URING:
+#ifdef HAVE_IO_URING
+        res = uring_setup(out);
+#else
+        res = -1;
+#endif
+        break;
+    case OUTPUT_MMAP:
+        res = mmap_setup(out);
+        break;
+    case OUTPUT_ZEROCOPY:
+        res = zerocopy_setup(out);
+        break;
+    default:
+        break;
+    }
+
+    if (res < 0) {
+        munmap(out->region, out->region_len);
+        return -1;
+    }
+    out->backend = backend;
+    return 0;
+}
+
+
+int
+output_close(
+    struct output* out
+) {
+    int res = output_flush(out);
+#ifdef HAVE_IO_URING
+    if (out->backend == OUTPUT_URING && uring_teardown(out) < 0)
+        res = -1;
+#endif
+    if (out->backend == OUTPUT_MMAP && mmap_teardown(out) < 0)
+        res = -1;
+    if (out->backend == OUTPUT_ZEROCOPY && zerocopy_teardown(out) < 0)
+        res = -1;
+    munmap(out->region, out->region_len);
+    return res;
+}
+
+
+int
+output_flush(
+    struct output* out
+) {
+    if (out->len == 0)
+        return 0;
+
+    size_t const len = out->len;
+    out->len = 0;
+
+#ifdef HAVE_IO_URING
+    if (out->backend == OUTPUT_URING)
+        return uring_flush(out, len);
+#endif
+    if (out->backend == OUTPUT_MMAP) {
+        // the data is in the file already
+        out->offset += len;
+        return mmap_window(out);
+    }
+    if (out->backend == OUTPUT_ZEROCOPY)
+        return zerocopy_flush(out, len);
+    if (out->backend == OUTPUT_VMSPLICE) {
+        size_t spliced = 0;
+        if (splice_buf(out->fd, out->buf, len, &spliced) == 0)
+            return 0;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+
+        // not spliceable after all, so only the rest is written, but the
+        // pages gifted already must not be reused
+        out->backend = OUTPUT_WRITEV;
+        if (write_buf(out->fd, out->buf + spliced, len - spliced) < 0)
+            return -1;
+        return spliced > 0 ? release_pages(out->buf, len) : 0;
+    }
+    return write_buf(out->fd, out->buf, len);
+}
+
+
+char*
+output_reserve(
+    struct output* out,
+    size_t len
+) {
+    if (OUTPUT_BUFFER - out->len < len && output_flush(out) < 0)
+        return NULL;
+    return out->buf + out->len;
+}
+
+
+void
+output_commit(
+    struct output* out,
+    size_t len
+) {
+    out->len += len;
+}
+
+
+int
+output_write(
+    struct output* out,
+    void const* data,
+    size_t len
+) {
+    char const* pos = data;
+    while (len > 0) {
+        if (out->len == OUTPUT_BUFFER && output_flush(out) < 0)
+            return -1;
+
+        size_t chunk = OUTPUT_BUFFER - out->len;
+        if (chunk > len)
+            chunk = len;
+        memcpy(out->buf + out->len, pos, chunk);
+        out->len += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+
+int
+output_gather(
+    struct output* out,
+    struct iovec const* vecs,
+    size_t count
+) {
+    for (; count > 0; ++vecs, --count)
+        if (output_write(out, vecs->iov_base, vecs->iov_len) < 0)
+            return -1;
+    return 0;
+}
+
+
+int
+output_writev(
+    struct output* out,
+    struct iovec* vecs,
+    size_t count
+) {
+    if (out->backend == OUTPUT_WRITEV) {
+        if (output_flush(out) < 0)
+            return -1;
+        return write_vecs(out->fd, vecs, count);
+    }
+    return output_gather(out, vecs, count);
+}
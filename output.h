@@ -0,0 +1,227 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+/**
+ * Size of the output buffer in bytes
+ *
+ * Any single reservation must not exceed this size.
+ */
+#define OUTPUT_BUFFER (1 << 20)
+
+
+/**
+ * Number of buffers used with the io_uring and zerocopy backends
+ *
+ * While one buffer is being filled, the others may be in flight.
+ */
+#define OUTPUT_DEPTH 4
+
+
+/**
+ * Output backends
+ */
+enum output_backend {
+    OUTPUT_WRITEV, ///< `write()` for buffered data, `writev()` for iovecs
+    OUTPUT_VMSPLICE, ///< buffers gifted to a pipe via `vmsplice()`
+    OUTPUT_URING, ///< asynchronous writes of registered buffers via io_uring
+    OUTPUT_MMAP, ///< data copied into a file mapped into memory
+    OUTPUT_ZEROCOPY ///< buffers sent to a socket via `MSG_ZEROCOPY`
+};
+
+
+/**
+ * Write of a buffer in flight
+ */
+struct output_inflight {
+    size_t len; ///< number of bytes to write
+    off_t offset; ///< offset in the file to write to
+    int busy; ///< whether the write is still in flight
+    uint32_t first_send; ///< number of the first zerocopy send of the buffer
+    uint32_t sends; ///< number of zerocopy sends of the buffer
+    uint32_t pending; ///< number of those sends not completed yet
+};
+
+
+/**
+ * Buffered output
+ *
+ * Data is collected in a page aligned buffer and handed to the backend once
+ * the buffer is full or when flushing explicitly. With the mmap backend, the
+ * buffer is a window into the file itself, which is moved on when flushing.
+ */
+struct output {
+    int fd; ///< file descriptor to write to
+    enum output_backend backend; ///< backend in use
+    char* buf; ///< page aligned buffer of `OUTPUT_BUFFER` bytes being filled
+    size_t len; ///< number of bytes in the buffer
+    char* region; ///< mapping holding all buffers
+    size_t region_len; ///< length of the mapping
+    struct uring* ring; ///< io_uring instance for the io_uring backend
+    unsigned int current; ///< index of the buffer being filled
+    off_t offset; ///< offset in the file to write the next buffer to
+    struct output_inflight inflight[OUTPUT_DEPTH]; ///< writes of the buffers
+    int map_fd; ///< file opened for reading and writing for the mmap backend
+    off_t size; ///< size of the file before any output, for the mmap backend
+    off_t grown; ///< size the file was grown to by the mmap backend
+    uint32_t sends; ///< number of zerocopy sends so far
+    int copied; ///< whether the kernel copied data sent with `MSG_ZEROCOPY`
+};
+
+
+/**
+ * Initialize buffered output
+ *
+ * The backend is chosen based on what `fd` refers to: the vmsplice backend
+ * for pipes, io_uring for regular files if available and the zerocopy backend
+ * for sockets supporting it. Otherwise, e.g. for terminals, writev is used.
+ * The mmap backend is never chosen, since taking a page fault for each page
+ * written costs more than copying the data via `write()`.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+output_init(
+    struct output* out, ///< output to initialize
+    int fd ///< file descriptor to write to
+);
+
+
+/**
+ * Initialize buffered output using a given backend
+ *
+ * Returns `0` on success, `-1` on error or if the backend can't be used for
+ * `fd`.
+ */
+int
+output_init_backend(
+    struct output* out, ///< output to initialize
+    int fd, ///< file descriptor to write to
+    enum output_backend backend ///< backend to use
+);
+
+
+/**
+ * Flush and release buffered output
+ *
+ * Returns `0` on success, `-1` if the remaining data could not be written.
+ */
+int
+output_close(
+    struct output* out ///< output to close
+);
+
+
+/**
+ * Write out all data buffered
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+output_flush(
+    struct output* out ///< output to flush
+);
+
+
+/**
+ * Reserve space in the output buffer
+ *
+ * The buffer is flushed if it doesn't have `len` bytes left. The data written
+ * to the space returned becomes part of the output once committed via
+ * `output_commit()`.
+ *
+ * Returns the space reserved or `NULL` on error.
+ */
+char*
+output_reserve(
+    struct output* out, ///< output to reserve space in
+    size_t len ///< number of bytes to reserve, at most `OUTPUT_BUFFER`
+);
+
+
+/**
+ * Commit data written to space previously reserved
+ */
+void
+output_commit(
+    struct output* out, ///< output to commit to
+    size_t len ///< number of bytes to commit
+);
+
+
+/**
+ * Write a buffer
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+output_write(
+    struct output* out, ///< output to write to
+    void const* data, ///< data to write
+    size_t len ///< number of bytes to write
+);
+
+
+/**
+ * Gather the data referred to by a number of iovecs in the buffer
+ *
+ * Unlike `output_writev()`, this never bypasses the buffer, regardless of the
+ * backend.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+output_gather(
+    struct output* out, ///< output to write to
+    struct iovec const* vecs, ///< iovecs to gather
+    size_t count ///< number of iovecs
+);
+
+
+/**
+ * Write the data referred to by a number of iovecs
+ *
+ * With the writev backend, the iovecs are passed to the kernel directly after
+ * flushing the buffer. Otherwise, the data is gathered in the buffer. The
+ * iovecs may be modified in the process.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+output_writev(
+    struct output* out, ///< output to write to
+    struct iovec* vecs, ///< iovecs to write
+    size_t count ///< number of iovecs
+);
+
+
+#endif
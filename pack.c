@@ -0,0 +1,231 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "d6.h"
+
+
+void
+d6_encode_numeric(
+    char* out,
+    uint8_t const* values,
+    size_t count,
+    char sep
+) {
+#ifdef __SSE2__
+    __m128i const zero = _mm_set1_epi8('0');
+    __m128i const seps = _mm_set1_epi8(sep);
+    for (; count >= 16; count -= 16) {
+        __m128i const digits = _mm_add_epi8(
+            _mm_loadu_si128((__m128i const*) values),
+            zero
+        );
+        _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi8(digits, seps));
+        _mm_storeu_si128((__m128i*) out + 1, _mm_unpackhi_epi8(digits, seps));
+        values += 16;
+        out += 32;
+    }
+#endif
+    while (count-- > 0) {
+        *out++ = *values++ + '0';
+        *out++ = sep;
+    }
+}
+
+
+uint8_t const d6_pack_header[D6_PACK_HEADER_LEN] = {'d', '6', 'p', 'k', D6_PACK_VERSION, 6};
+
+
+size_t
+d6_packed_len(
+    size_t count
+) {
+    return (count + D6_PACK_BLOCK_DICE - 1) / D6_PACK_BLOCK_DICE * D6_PACK_BLOCK_LEN;
+}
+
+
+int
+d6_check_pack_header(
+    uint8_t const* header
+) {
+    return memcmp(header, d6_pack_header, D6_PACK_HEADER_LEN) == 0 ? 0 : -1;
+}
+
+
+/**
+ * Pack a number of complete blocks of dice
+ */
+static void
+pack_blocks(
+    uint8_t* out, ///< buffer to pack to
+    uint8_t const* values, ///< values to pack
+    size_t blocks ///< number of blocks to pack
+) {
+#ifdef __SSE2__
+    __m128i const one = _mm_set1_epi8(1);
+    for (; blocks > 0; --blocks) {
+        __m128i digit[3];
+        for (int row = 0; row < 3; ++row)
+            digit[row] = _mm_sub_epi8(
+                _mm_loadu_si128((__m128i const*) values + row),
+                one
+            );
+
+        // all intermediate values fit in a byte, so 16bit shifts are safe
+        __m128i const low = _mm_add_epi8(
+            digit[0],
+            _mm_add_epi8(_mm_slli_epi16(digit[1], 2), _mm_slli_epi16(digit[1], 1))
+        );
+        __m128i const high = _mm_add_epi8(
+            _mm_slli_epi16(digit[2], 5),
+            _mm_slli_epi16(digit[2], 2)
+        );
+        _mm_storeu_si128((__m128i*) out, _mm_add_epi8(low, high));
+
+        values += D6_PACK_BLOCK_DICE;
+        out += D6_PACK_BLOCK_LEN;
+    }
+#else
+    for (; blocks > 0; --blocks) {
+        for (int j = 0; j < D6_PACK_BLOCK_LEN; ++j)
+            out[j] = (values[j] - 1) + 6 * (values[16 + j] - 1) +
+                36 * (values[32 + j] - 1);
+        values += D6_PACK_BLOCK_DICE;
+        out += D6_PACK_BLOCK_LEN;
+    }
+#endif
+}
+
+
+size_t
+d6_pack(
+    uint8_t* out,
+    uint8_t const* values,
+    size_t count
+) {
+    size_t const blocks = count / D6_PACK_BLOCK_DICE;
+    pack_blocks(out, values, blocks);
+
+    size_t const rest = count % D6_PACK_BLOCK_DICE;
+    if (rest > 0) {
+        uint8_t last[D6_PACK_BLOCK_DICE];
+        memset(last, 1, sizeof(last));
+        memcpy(last, values + blocks * D6_PACK_BLOCK_DICE, rest);
+        pack_blocks(out + blocks * D6_PACK_BLOCK_LEN, last, 1);
+    }
+    return d6_packed_len(count);
+}
+
+
+/**
+ * Unpack a number of complete blocks of dice
+ */
+static void
+unpack_blocks(
+    uint8_t* values, ///< values to unpack to
+    uint8_t const* packed, ///< packed dice
+    size_t blocks ///< number of blocks to unpack
+) {
+#ifdef __SSE2__
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const one = _mm_set1_epi8(1);
+    __m128i const six = _mm_set1_epi16(6);
+    __m128i const thirty_six = _mm_set1_epi16(36);
+    // reciprocals exact for all the values in question
+    __m128i const div_six = _mm_set1_epi16(10923);
+    __m128i const div_thirty_six = _mm_set1_epi16(1821);
+
+    for (; blocks > 0; --blocks) {
+        __m128i const bytes = _mm_loadu_si128((__m128i const*) packed);
+        __m128i digit[3][2];
+        for (int half = 0; half < 2; ++half) {
+            __m128i const word = half ?
+                _mm_unpackhi_epi8(bytes, zero) :
+                _mm_unpacklo_epi8(bytes, zero);
+            __m128i const high = _mm_mulhi_epu16(word, div_thirty_six);
+            __m128i const rest = _mm_sub_epi16(
+                word,
+                _mm_mullo_epi16(high, thirty_six)
+            );
+            __m128i const mid = _mm_mulhi_epu16(rest, div_six);
+            digit[0][half] = _mm_sub_epi16(rest, _mm_mullo_epi16(mid, six));
+            digit[1][half] = mid;
+            digit[2][half] = high;
+        }
+
+        for (int row = 0; row < 3; ++row)
+            _mm_storeu_si128(
+                (__m128i*) values + row,
+                _mm_add_epi8(_mm_packus_epi16(digit[row][0], digit[row][1]), one)
+            );
+
+        values += D6_PACK_BLOCK_DICE;
+        packed += D6_PACK_BLOCK_LEN;
+    }
+#else
+    for (; blocks > 0; --blocks) {
+        for (int j = 0; j < D6_PACK_BLOCK_LEN; ++j) {
+            values[j] = packed[j] % 6 + 1;
+            values[16 + j] = packed[j] / 6 % 6 + 1;
+            values[32 + j] = packed[j] / 36 + 1;
+        }
+        values += D6_PACK_BLOCK_DICE;
+        packed += D6_PACK_BLOCK_LEN;
+    }
+#endif
+}
+
+
+void
+d6_unpack(
+    uint8_t* values,
+    uint8_t const* packed,
+    size_t count
+) {
+    size_t const blocks = count / D6_PACK_BLOCK_DICE;
+    unpack_blocks(values, packed, blocks);
+
+    size_t const rest = count % D6_PACK_BLOCK_DICE;
+    if (rest > 0) {
+        uint8_t last[D6_PACK_BLOCK_DICE];
+        unpack_blocks(last, packed + blocks * D6_PACK_BLOCK_LEN, 1);
+        memcpy(values + blocks * D6_PACK_BLOCK_DICE, last, rest);
+    }
+}
+
+
+uint8_t
+d6_packed_dice(
+    uint8_t const* packed,
+    size_t index
+) {
+    static uint8_t const div[3] = {1, 6, 36};
+    uint8_t const byte = packed[index / D6_PACK_BLOCK_DICE * D6_PACK_BLOCK_LEN +
+        index % D6_PACK_BLOCK_LEN];
+    return byte / div[index % D6_PACK_BLOCK_DICE / D6_PACK_BLOCK_LEN] % 6 + 1;
+}
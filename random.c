@@ -0,0 +1,406 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#include <linux/futex.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "d6.h"
+
+
+void
+d6_pool_init(
+    struct d6_pool* pool
+) {
+    pool->pos = D6_POOL_SIZE;
+    pool->used = 0;
+    pool->drbg = NULL;
+    pool->prefetch = NULL;
+}
+
+
+/**
+ * Fill a buffer with random data directly from the kernel
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+get_random(
+    void* dest, ///< buffer to fill
+    size_t len ///< number of bytes to fill
+) {
+    uint8_t* pos = dest;
+    while (len > 0) {
+        ssize_t got = getrandom(pos, len, 0);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        pos += got;
+        len -= got;
+    }
+    return 0;
+}
+
+
+/**
+ * Fill a buffer with random data from the source backing a pool
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+static int
+pool_source(
+    struct d6_pool* pool, ///< pool to get data for
+    void* dest, ///< buffer to fill
+    size_t len ///< number of bytes to fill
+) {
+    if (pool->drbg) {
+        d6_chacha_generate(pool->drbg, dest, len);
+        return 0;
+    }
+
+    // whatever the ring cannot provide is requested from the kernel directly
+    uint8_t* pos = dest;
+    if (pool->prefetch)
+        for (; len >= D6_POOL_SIZE; pos += D6_POOL_SIZE, len -= D6_POOL_SIZE)
+            if (d6_prefetch_read(pool->prefetch, pos) < 0)
+                break;
+    return get_random(pos, len);
+}
+
+
+/**
+ * Wait on a futex as long as it holds a given value
+ */
+static void
+futex_wait(
+    uint32_t* word, ///< futex word
+    uint32_t value ///< value to wait on
+) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+
+/**
+ * Wake the waiter on a futex after changing its value
+ */
+static void
+futex_wake(
+    uint32_t* word ///< futex word
+) {
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+/**
+ * Keep a prefetch ring filled
+ *
+ * This function is run by the producer thread. Slots are filled in order. Once
+ * the ring is full, the thread sleeps until it is drained to half its size.
+ */
+static void*
+prefetch_produce(
+    void* arg ///< ring to fill
+) {
+    struct d6_prefetch* const prefetch = arg;
+
+    while (!__atomic_load_n(&prefetch->stop, __ATOMIC_SEQ_CST)) {
+        uint64_t const pos = prefetch->tail;
+        size_t const slot = pos % D6_PREFETCH_SLOTS;
+
+        if (__atomic_load_n(prefetch->seq + slot, __ATOMIC_ACQUIRE) != pos) {
+            // Announce sleeping before checking the ring. A consumer draining
+            // it afterwards will see the announcement and wake us.
+            uint32_t const wake = __atomic_load_n(&prefetch->wake,
+                                                  __ATOMIC_SEQ_CST);
+            __atomic_store_n(&prefetch->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (pos - __atomic_load_n(&prefetch->head, __ATOMIC_SEQ_CST) >
+                    D6_PREFETCH_SLOTS / 2 &&
+                    !__atomic_load_n(&prefetch->stop, __ATOMIC_SEQ_CST))
+                futex_wait(&prefetch->wake, wake);
+            __atomic_store_n(&prefetch->sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        if (get_random(prefetch->data[slot], D6_POOL_SIZE) < 0) {
+            __atomic_store_n(&prefetch->error, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        __atomic_store_n(prefetch->seq + slot, pos + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&prefetch->tail, pos + 1, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+
+int
+d6_prefetch_start(
+    struct d6_prefetch* prefetch
+) {
+    for (size_t slot = 0; slot < D6_PREFETCH_SLOTS; ++slot)
+        prefetch->seq[slot] = slot;
+    prefetch->head = 0;
+    prefetch->tail = 0;
+    prefetch->wake = 0;
+    prefetch->sleeping = 0;
+    prefetch->stop = 0;
+    prefetch->error = 0;
+    prefetch->misses = 0;
+
+    // the producer inherits the signal mask, but must not take any signals
+    // meant for the caller's threads, e.g. to be read via a signalfd
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int const res = pthread_create(&prefetch->thread, NULL, prefetch_produce,
+                                   prefetch);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return res != 0 ? -1 : 0;
+}
+
+
+void
+d6_prefetch_stop(
+    struct d6_prefetch* prefetch
+) {
+    __atomic_store_n(&prefetch->stop, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&prefetch->wake);
+    pthread_join(prefetch->thread, NULL);
+}
+
+
+int
+d6_prefetch_read(
+    struct d6_prefetch* prefetch,
+    void* dest
+) {
+    uint64_t pos = __atomic_load_n(&prefetch->head, __ATOMIC_RELAXED);
+    size_t slot;
+    for (;;) {
+        slot = pos % D6_PREFETCH_SLOTS;
+        uint64_t const seq = __atomic_load_n(prefetch->seq + slot,
+                                             __ATOMIC_ACQUIRE);
+        int64_t const diff = (int64_t) (seq - (pos + 1));
+        if (diff < 0) {
+            __atomic_add_fetch(&prefetch->misses, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+
+        // on failure, the exchange updates `pos` to the current head
+        if (diff == 0 && __atomic_compare_exchange_n(&prefetch->head, &pos,
+                                                     pos + 1, 0,
+                                                     __ATOMIC_SEQ_CST,
+                                                     __ATOMIC_RELAXED))
+            break;
+        if (diff > 0)
+            pos = __atomic_load_n(&prefetch->head, __ATOMIC_RELAXED);
+    }
+
+    memcpy(dest, prefetch->data[slot], D6_POOL_SIZE);
+    // hand the slot back to the producer for its next round
+    __atomic_store_n(prefetch->seq + slot, pos + D6_PREFETCH_SLOTS,
+                     __ATOMIC_RELEASE);
+
+    uint64_t const tail = __atomic_load_n(&prefetch->tail, __ATOMIC_SEQ_CST);
+    if (tail - (pos + 1) <= D6_PREFETCH_SLOTS / 2 &&
+            __atomic_load_n(&prefetch->sleeping, __ATOMIC_SEQ_CST))
+        futex_wake(&prefetch->wake);
+    return 0;
+}
+
+
+int
+d6_pool_read(
+    struct d6_pool* pool,
+    void* dest,
+    size_t len
+) {
+    uint8_t* pos = dest;
+    pool->used += len;
+    while (len > 0) {
+        size_t avail = D6_POOL_SIZE - pool->pos;
+        if (avail == 0 && len >= D6_POOL_SIZE) {
+            size_t const direct = len - len % D6_POOL_SIZE;
+            if (pool_source(pool, pos, direct) < 0)
+                return -1;
+            pos += direct;
+            len -= direct;
+            continue;
+        }
+
+        if (avail == 0) {
+            if (pool_source(pool, pool->data, D6_POOL_SIZE) < 0)
+                return -1;
+            pool->pos = 0;
+            avail = D6_POOL_SIZE;
+        }
+
+        if (avail > len)
+            avail = len;
+        memcpy(pos, pool->data + pool->pos, avail);
+        pool->pos += avail;
+        pos += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+
+void
+d6_extractor_init(
+    struct d6_extractor* extractor,
+    struct d6_pool* pool
+) {
+    extractor->pool = pool;
+    extractor->value = 0;
+    extractor->range = 1;
+}
+
+
+int
+d6_extract(
+    struct d6_extractor* extractor,
+    uint8_t* values,
+    size_t count
+) {
+    uint64_t value = extractor->value;
+    uint64_t range = extractor->range;
+
+    while (count > 0) {
+        if (range < ((uint64_t) 1 << 32)) {
+            uint32_t bits;
+            if (d6_pool_read(extractor->pool, &bits, sizeof(bits)) < 0)
+                goto error;
+            value = value << 32 | bits;
+            range <<= 32;
+        }
+
+        uint64_t const limit = range - range % 6;
+        if (value < limit) {
+            *values++ = value % 6 + 1;
+            value /= 6;
+            range = limit / 6;
+            --count;
+        } else {
+            // recycle the entropy of the rejected value
+            value -= limit;
+            range -= limit;
+        }
+    }
+
+    extractor->value = value;
+    extractor->range = range;
+    return 0;
+
+error:
+    extractor->value = value;
+    extractor->range = range;
+    return -1;
+}
+
+
+void
+d6_init(
+    struct d6* d6
+) {
+    d6_pool_init(&d6->pool);
+    d6_extractor_init(&d6->extractor, &d6->pool);
+    d6->seeded = 0;
+}
+
+
+int
+d6_init_drbg(
+    struct d6* d6
+) {
+    uint8_t key[32];
+    if (get_random(key, sizeof(key)) < 0)
+        return -1;
+
+    d6_chacha_init(&d6->drbg, key, 0);
+    d6_init(d6);
+    d6->pool.drbg = &d6->drbg;
+    return 0;
+}
+
+
+void
+d6_init_seeded(
+    struct d6* d6,
+    uint64_t seed
+) {
+    uint8_t key[32] = {0};
+    for (int byte = 0; byte < 8; ++byte)
+        key[byte] = seed >> (8 * byte);
+
+    d6_init(d6);
+    d6_chacha_init(&d6->stream, key, 0);
+    d6_chacha_init(&d6->drbg, key, 1);
+    d6->pool.drbg = &d6->drbg;
+    d6->position = 0;
+    d6->seeded = 1;
+}
+
+
+void
+d6_seek(
+    struct d6* d6,
+    uint64_t position
+) {
+    d6->position = position;
+}
+
+
+int
+d6_roll(
+    struct d6* d6,
+    uint8_t* values,
+    size_t count
+) {
+    if (d6->seeded)
+        return d6_roll_batch(d6, values, count);
+    return d6_extract(&d6->extractor, values, count);
+}
+
+
+int
+d6_roll_batch(
+    struct d6* d6,
+    uint8_t* values,
+    size_t count
+) {
+    if (d6->seeded) {
+        d6_fill_seeded(&d6->stream, d6->position, values, count);
+        d6->position += count;
+        return 0;
+    }
+    return d6_fill(&d6->pool, values, count);
+}
@@ -0,0 +1,373 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <pthread.h>
+
+#include "d6.h"
+#include "faces.h"
+
+
+/**
+ * Dice data
+ *
+ * There are nine positions for pips on each d6, which we enumerate starting
+ * form `0`:
+ *
+ *     #######
+ *     #0 1 2#
+ *     #3 4 5#
+ *     #6 7 8#
+ *     #######
+ *
+ * Hence, we can represent the pip-configuration of a dice using 9 bits. The
+ * six configurations for a d6 easily fit into a 64bit integer value. We even
+ * have the luxury of starting at an offset without wasting memory.
+ */
+static const uint64_t pips =
+    ((uint64_t) 0020) << (1*9) |
+    ((uint64_t) 0104) << (2*9) |
+    ((uint64_t) 0124) << (3*9) |
+    ((uint64_t) 0505) << (4*9) |
+    ((uint64_t) 0525) << (5*9) |
+    ((uint64_t) 0555) << (6*9);
+
+
+/**
+ * The length of a row for one dice, including the space after the dice
+ *
+ * 7 pixels for the dice face + the separating pixel, times 2 characters per
+ * pixel.
+ */
+static const size_t dice_row_len = 16;
+
+
+/**
+ * Variations of lines which occur in a dice
+ *
+ * A line contains up to three pips, each of which may be represented by one
+ * bit. Hence, eight differente variations of a line exist, enumerable via the
+ * three bits. However, only a subset of those lines do occur.
+ */
+#define PART_0 "##############  "
+#define PART_1 "##  ##########  "
+#define PART_2 "######  ######  "
+#define PART_4 "##########  ##  "
+#define PART_5 "##  ######  ##  "
+
+static char const* dice_parts[] = {
+    PART_0,
+    PART_1,
+    PART_2,
+    NULL,
+    PART_4,
+    PART_5
+};
+
+
+/**
+ * Number of variations of lines which do occur
+ */
+#define PART_COUNT 5
+
+
+/**
+ * Index of each variation of a line among those which do occur
+ */
+static uint8_t const part_index[] = {0, 1, 2, 0, 3, 4};
+
+
+/**
+ * Initializers joining a prefix with every variation and pair of variations
+ */
+#define JOIN_PARTS(prefix) \
+    prefix PART_0, prefix PART_1, prefix PART_2, prefix PART_4, prefix PART_5
+#define JOIN_PAIRS(prefix) \
+    JOIN_PARTS(prefix PART_0), JOIN_PARTS(prefix PART_1), \
+    JOIN_PARTS(prefix PART_2), JOIN_PARTS(prefix PART_4), \
+    JOIN_PARTS(prefix PART_5)
+
+
+/**
+ * Lines of two dice side by side
+ *
+ * The line consisting of the variations with the indices `a` and `b` (as per
+ * `part_index`) is found at `a * PART_COUNT + b`.
+ */
+static char const pair_parts[][sizeof(PART_0 PART_0)] = {
+    JOIN_PAIRS()
+};
+
+
+/**
+ * Lines of three dice side by side
+ *
+ * The line consisting of the variations with the indices `a`, `b` and `c` (as
+ * per `part_index`) is found at `(a * PART_COUNT + b) * PART_COUNT + c`.
+ */
+static char const triple_parts[][sizeof(PART_0 PART_0 PART_0)] = {
+    JOIN_PAIRS(PART_0),
+    JOIN_PAIRS(PART_1),
+    JOIN_PAIRS(PART_2),
+    JOIN_PAIRS(PART_4),
+    JOIN_PAIRS(PART_5)
+};
+
+
+/**
+ * Get the variation of a line of a dice face
+ *
+ * Returns the index of the variation in `dice_parts`.
+ */
+static uint8_t
+row_part(
+    uint8_t row, ///< row of the dice face
+    uint8_t value ///< value shown by the dice face
+) {
+    if (!(row & 1))
+        return 0;
+    return (pips >> (value*9 + 3*(row/2))) & 7;
+}
+
+
+struct iovec
+d6_row_vec(
+    uint8_t row,
+    uint8_t value
+) {
+    struct iovec retval;
+
+    retval.iov_base = (void*) dice_parts[row_part(row, value)];
+    retval.iov_len = dice_row_len;
+    return retval;
+};
+
+
+/**
+ * Prepare the iovecs rendering a row of dice showing pips side by side
+ *
+ * Each iovec covers up to three dice. No line break is appended.
+ *
+ * Returns the iovec following the last one prepared.
+ */
+static struct iovec*
+join_row(
+    struct iovec* vec, ///< first iovec to prepare
+    uint8_t row, ///< row of the dice faces
+    uint8_t const* values, ///< values of the dice to render
+    unsigned int count ///< number of dice to render
+) {
+    unsigned int dice_num = 0;
+    for (; count - dice_num >= 3; dice_num += 3) {
+        unsigned int index = part_index[row_part(row, values[dice_num])];
+        index = index * PART_COUNT +
+            part_index[row_part(row, values[dice_num + 1])];
+        index = index * PART_COUNT +
+            part_index[row_part(row, values[dice_num + 2])];
+        vec->iov_base = (void*) triple_parts[index];
+        vec->iov_len = 3 * dice_row_len;
+        ++vec;
+    }
+
+    if (count - dice_num == 2) {
+        unsigned int index = part_index[row_part(row, values[dice_num])];
+        index = index * PART_COUNT +
+            part_index[row_part(row, values[dice_num + 1])];
+        vec->iov_base = (void*) pair_parts[index];
+        vec->iov_len = 2 * dice_row_len;
+        ++vec;
+    } else if (count - dice_num == 1) {
+        *vec++ = d6_row_vec(row, values[dice_num]);
+    }
+    return vec;
+}
+
+
+size_t
+d6_render_rows(
+    struct iovec* vecs,
+    uint8_t const* values,
+    unsigned int count
+) {
+    struct iovec* vec = vecs;
+
+    for (uint8_t row = 0; row < 7; ++row) {
+        vec = join_row(vec, row, values, count);
+        vec->iov_base = "\n";
+        vec->iov_len = 1;
+        ++vec;
+    }
+
+    return vec - vecs;
+}
+
+
+size_t
+d6_render_rows_single(
+    struct iovec* vecs,
+    uint8_t const* values,
+    unsigned int count
+) {
+    // put line ends
+    {
+        uint8_t row = 7;
+        while (row-- > 0) {
+            struct iovec* line_end = vecs + (row * (count+1) + count);
+            line_end->iov_base = "\n";
+            line_end->iov_len = 1;
+        }
+    }
+
+    for (unsigned int dice_num = 0; dice_num < count; ++dice_num) {
+        uint8_t row = 7;
+        while (row-- > 0)
+            vecs[row * (count+1) + dice_num] = d6_row_vec(row, values[dice_num]);
+    }
+
+    return 7 * (count + 1);
+}
+
+
+struct iovec
+d6_face_vec(
+    uint8_t row,
+    uint8_t value,
+    uint8_t sides
+) {
+    if (sides <= 6)
+        return d6_row_vec(row, value);
+
+    struct iovec retval;
+    retval.iov_base = (void*) numeric_faces[value - 1][row];
+    retval.iov_len = dice_row_len;
+    return retval;
+}
+
+
+size_t
+d6_render_mixed(
+    struct iovec* vecs,
+    uint8_t const* values,
+    uint8_t const* sides,
+    unsigned int count
+) {
+    struct iovec* vec = vecs;
+
+    for (uint8_t row = 0; row < 7; ++row) {
+        unsigned int dice_num = 0;
+        while (dice_num < count) {
+            if (sides[dice_num] > 6) {
+                *vec++ = d6_face_vec(row, values[dice_num], sides[dice_num]);
+                ++dice_num;
+                continue;
+            }
+
+            unsigned int run = dice_num + 1;
+            while (run < count && sides[run] <= 6)
+                ++run;
+            vec = join_row(vec, row, values + dice_num, run - dice_num);
+            dice_num = run;
+        }
+
+        vec->iov_base = "\n";
+        vec->iov_len = 1;
+        ++vec;
+    }
+
+    return vec - vecs;
+}
+
+
+/**
+ * Rows of each dice face
+ *
+ * Row `r` of the face showing `v` is found at `face_cache[v - 1][r]`. Each row
+ * is aligned to 16 bytes so that it may be loaded with a single aligned load.
+ * The cache is filled from `pips` and `dice_parts` once, on first use.
+ */
+static char face_cache[6][7][16] __attribute__((aligned(16)));
+
+
+/**
+ * Guard for filling the face cache
+ */
+static pthread_once_t face_cache_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Fill the face cache
+ */
+static void
+fill_face_cache(void) {
+    for (uint8_t value = 1; value <= 6; ++value)
+        for (uint8_t row = 0; row < 7; ++row)
+            memcpy(face_cache[value - 1][row],
+                   dice_parts[row_part(row, value)], dice_row_len);
+}
+
+
+size_t
+d6_render_text(
+    char* text,
+    uint8_t const* values,
+    unsigned int count
+) {
+    pthread_once(&face_cache_once, fill_face_cache);
+
+    char* pos = text;
+    for (uint8_t row = 0; row < 7; ++row) {
+#ifdef __SSE2__
+        // the rows of the output are not aligned due to the line ends
+        if (row & 1) {
+            for (unsigned int dice_num = 0; dice_num < count; ++dice_num) {
+                __m128i const face_row = _mm_load_si128(
+                    (__m128i const*) face_cache[values[dice_num] - 1][row]
+                );
+                _mm_storeu_si128((__m128i*) pos, face_row);
+                pos += dice_row_len;
+            }
+        } else {
+            // rows without pips are the same for all faces
+            __m128i const face_row = _mm_load_si128(
+                (__m128i const*) face_cache[0][row]
+            );
+            for (unsigned int dice_num = 0; dice_num < count; ++dice_num) {
+                _mm_storeu_si128((__m128i*) pos, face_row);
+                pos += dice_row_len;
+            }
+        }
+#else
+        for (unsigned int dice_num = 0; dice_num < count; ++dice_num) {
+            memcpy(pos, face_cache[values[dice_num] - 1][row], dice_row_len);
+            pos += dice_row_len;
+        }
+#endif
+        *pos++ = '\n';
+    }
+    return pos - text;
+}
@@ -0,0 +1,441 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+
+/**
+ * Number of events handled per call to `epoll_wait()`
+ */
+#define SERVE_EVENTS 64
+
+
+/**
+ * Size of the buffer for incoming requests of a connection
+ */
+#define SERVE_INPUT (64 * D6_SERVE_REQUEST_LEN)
+
+
+/**
+ * Amount of pending output above which requests are not processed
+ *
+ * Reading from a connection is suspended while this much output is waiting to
+ * be sent. Hence, a client cannot make the daemon buffer unlimited amounts of
+ * output by not receiving responses.
+ */
+#define SERVE_PENDING (1 << 20)
+
+
+/**
+ * Number of dice rendered side by side in the faces format
+ */
+#define SERVE_BAND 10
+
+
+/**
+ * State of a client connection
+ */
+struct connection {
+    struct connection* prev; ///< previous connection in the list of all
+    struct connection* next; ///< next connection in the list of all
+    int fd; ///< socket of the connection
+    uint32_t events; ///< events currently waited for
+    int eof; ///< whether the client closed its side of the connection
+    uint8_t input[SERVE_INPUT]; ///< incoming requests not processed yet
+    size_t input_len; ///< number of bytes in `input`
+    uint8_t* output; ///< outgoing responses not sent yet
+    size_t output_pos; ///< number of bytes of `output` sent already
+    size_t output_len; ///< number of bytes in `output`
+    size_t output_cap; ///< capacity of `output`
+};
+
+
+/**
+ * Reserve space for a response at the end of a connection's output
+ *
+ * Returns the space reserved or `NULL` if memory could not be allocated.
+ */
+static uint8_t*
+reserve_output(
+    struct connection* conn, ///< connection to reserve space in
+    size_t len ///< number of bytes to reserve
+) {
+    if (conn->output_pos == conn->output_len)
+        conn->output_pos = conn->output_len = 0;
+
+    if (conn->output_len + len > conn->output_cap) {
+        size_t cap = conn->output_cap ? 2 * conn->output_cap : 4096;
+        while (cap < conn->output_len + len)
+            cap *= 2;
+        uint8_t* const output = realloc(conn->output, cap);
+        if (!output)
+            return NULL;
+        conn->output = output;
+        conn->output_cap = cap;
+    }
+    return conn->output + conn->output_len;
+}
+
+
+/**
+ * Render dice faces into a buffer
+ *
+ * The dice are rendered in bands of `SERVE_BAND` dice, separated by an empty
+ * line.
+ *
+ * Returns the number of bytes rendered.
+ */
+static size_t
+render_faces(
+    uint8_t* text, ///< buffer to render to
+    uint8_t const* values, ///< values of the dice to render
+    size_t count ///< number of dice to render
+) {
+    uint8_t* pos = text;
+
+    for (size_t band = 0; band < count; band += SERVE_BAND) {
+        unsigned int dice = SERVE_BAND;
+        if (count - band < dice)
+            dice = count - band;
+
+        if (band > 0)
+            *pos++ = '\n';
+        pos += d6_render_text((char*) pos, values + band, dice);
+    }
+    return pos - text;
+}
+
+
+/**
+ * Append the response to a request to a connection's output
+ *
+ * Returns `0` on success, `-1` if memory could not be allocated.
+ */
+static int
+respond(
+    struct d6* d6, ///< state to roll dice with
+    struct connection* conn, ///< connection to respond on
+    uint8_t const* request ///< request of `D6_SERVE_REQUEST_LEN` bytes
+) {
+    static uint8_t values[D6_SERVE_MAX_DICE];
+
+    uint32_t const count = (uint32_t) request[0] | (uint32_t) request[1] << 8 |
+        (uint32_t) request[2] << 16 | (uint32_t) request[3] << 24;
+    uint8_t const sides = request[4];
+    uint8_t const format = request[5];
+
+    uint8_t status = D6_SERVE_OK;
+    if (count < 1 || count > D6_SERVE_MAX_DICE || sides != 6 ||
+            format > D6_SERVE_FACES || request[6] || request[7])
+        status = D6_SERVE_INVALID;
+
+    // individual rolls are extracted rather than wasting a block of dice
+    if (status == D6_SERVE_OK &&
+            (count < D6_FILL_BLOCK_DICE ? d6_roll(d6, values, count) :
+                                          d6_roll_batch(d6, values, count)) < 0)
+        status = D6_SERVE_FAILED;
+
+    size_t max_len = 0;
+    if (status == D6_SERVE_OK)
+        max_len = format == D6_SERVE_FACES ?
+            (7 * 16 + 1) * count + 8 : 2 * count;
+    uint8_t* const response = reserve_output(
+        conn,
+        D6_SERVE_RESPONSE_LEN + max_len
+    );
+    if (!response)
+        return -1;
+
+    uint8_t* const payload = response + D6_SERVE_RESPONSE_LEN;
+    uint32_t len = 0;
+    if (status == D6_SERVE_OK) {
+        switch (format) {
+        case D6_SERVE_VALUES:
+            memcpy(payload, values, count);
+            len = count;
+            break;
+        case D6_SERVE_NUMERIC:
+            d6_encode_numeric((char*) payload, values, count, ' ');
+            len = 2 * count;
+            payload[len - 1] = '\n';
+            break;
+        default:
+            len = render_faces(payload, values, count);
+        }
+    }
+
+    response[0] = status;
+    response[1] = format;
+    response[2] = 0;
+    response[3] = 0;
+    response[4] = len;
+    response[5] = len >> 8;
+    response[6] = len >> 16;
+    response[7] = len >> 24;
+    conn->output_len += D6_SERVE_RESPONSE_LEN + len;
+    return 0;
+}
+
+
+/**
+ * Process the requests of a connection and send the responses
+ *
+ * Requests are read if `readable` is set. Buffered requests are processed as
+ * long as the pending output does not exceed `SERVE_PENDING` and the output is
+ * sent until the socket would block.
+ *
+ * Returns `1` if the connection should be kept, `0` if it should be closed.
+ */
+static int
+service(
+    struct d6* d6, ///< state to roll dice with
+    struct connection* conn, ///< connection to service
+    int readable ///< whether the socket is readable
+) {
+    if (readable && !conn->eof && conn->input_len < SERVE_INPUT) {
+        ssize_t got = recv(conn->fd, conn->input + conn->input_len,
+                           SERVE_INPUT - conn->input_len, 0);
+        if (got == 0)
+            conn->eof = 1;
+        else if (got > 0)
+            conn->input_len += got;
+        else if (errno != EAGAIN && errno != EINTR)
+            return 0;
+    }
+
+    for (;;) {
+        size_t pos = 0;
+        while (conn->input_len - pos >= D6_SERVE_REQUEST_LEN &&
+                conn->output_len - conn->output_pos < SERVE_PENDING) {
+            if (respond(d6, conn, conn->input + pos) < 0)
+                return 0;
+            pos += D6_SERVE_REQUEST_LEN;
+        }
+        memmove(conn->input, conn->input + pos, conn->input_len - pos);
+        conn->input_len -= pos;
+
+        while (conn->output_pos < conn->output_len) {
+            ssize_t sent = send(conn->fd, conn->output + conn->output_pos,
+                                conn->output_len - conn->output_pos,
+                                MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    break;
+                return 0;
+            }
+            conn->output_pos += sent;
+        }
+
+        // more buffered requests may be processed once the output was sent
+        if (conn->output_pos < conn->output_len ||
+                conn->input_len < D6_SERVE_REQUEST_LEN)
+            break;
+    }
+
+    return !conn->eof || conn->output_pos < conn->output_len;
+}
+
+
+/**
+ * Close a connection and release its state
+ */
+static void
+close_connection(
+    struct connection** list, ///< list of all connections
+    struct connection* conn ///< connection to close
+) {
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        *list = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    close(conn->fd);
+    free(conn->output);
+    free(conn);
+}
+
+
+/**
+ * Create a socket listening on a path
+ *
+ * If a socket exists at the path but nobody listens on it, it is replaced.
+ *
+ * Returns the socket or `-1` on error.
+ */
+static int
+listen_path(
+    char const* path ///< path to listen on
+) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+    if (fd < 0)
+        return -1;
+
+    int res = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    if (res < 0 && errno == EADDRINUSE) {
+        int const probe = d6_client_open(path);
+        if (probe >= 0) {
+            close(probe);
+        } else if (errno == ECONNREFUSED) {
+            unlink(path);
+            res = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+        }
+    }
+
+    if (res < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+int
+serve(
+    struct d6* d6,
+    char const* path
+) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+        return -1;
+
+    int sig_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int const listen_fd = listen_path(path);
+    int const epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct connection* connections = NULL;
+    int res = -1;
+    if (sig_fd < 0 || listen_fd < 0 || epoll_fd < 0)
+        goto out;
+
+    // the listening socket and the signalfd are told apart from connections
+    // by their pointers
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &sig_fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sig_fd, &event) < 0)
+        goto out;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)
+        goto out;
+
+    for (;;) {
+        struct epoll_event events[SERVE_EVENTS];
+        int const count = epoll_wait(epoll_fd, events, SERVE_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            goto out;
+        }
+
+        for (int index = 0; index < count; ++index) {
+            if (events[index].data.ptr == &sig_fd) {
+                // consume the signal so it is not delivered once unblocked
+                struct signalfd_siginfo info;
+                if (read(sig_fd, &info, sizeof(info)) == sizeof(info))
+                    res = 0;
+                goto out;
+            }
+
+            if (!events[index].data.ptr) {
+                int const fd = accept4(listen_fd, NULL, NULL,
+                                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                    continue;
+
+                struct connection* const conn = calloc(1, sizeof(*conn));
+                if (!conn) {
+                    close(fd);
+                    continue;
+                }
+                conn->fd = fd;
+                conn->events = EPOLLIN;
+                conn->next = connections;
+                if (connections)
+                    connections->prev = conn;
+                connections = conn;
+
+                event.events = conn->events;
+                event.data.ptr = conn;
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+                    close_connection(&connections, conn);
+                continue;
+            }
+
+            struct connection* const conn = events[index].data.ptr;
+            uint32_t const ready = events[index].events;
+            if (!service(d6, conn, ready & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                // closing the socket removes it from the epoll instance
+                close_connection(&connections, conn);
+                continue;
+            }
+
+            uint32_t wanted = 0;
+            if (!conn->eof && conn->input_len < SERVE_INPUT)
+                wanted |= EPOLLIN;
+            if (conn->output_pos < conn->output_len)
+                wanted |= EPOLLOUT;
+            if (wanted != conn->events) {
+                conn->events = wanted;
+                event.events = wanted;
+                event.data.ptr = conn;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+            }
+        }
+    }
+
+out:
+    while (connections)
+        close_connection(&connections, connections);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path);
+    }
+    if (sig_fd >= 0)
+        close(sig_fd);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    return res;
+}
@@ -0,0 +1,49 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "d6.h"
+
+
+/**
+ * Serve rolls on a Unix domain socket
+ *
+ * Clients connect to the socket at `path` and send requests as described for
+ * `D6_SERVE_REQUEST_LEN`, which are answered in order. All connections are
+ * handled in the calling thread via epoll, sharing the same state for rolling
+ * dice. A stale socket left behind by a previous daemon is replaced. The
+ * daemon runs until it receives `SIGINT` or `SIGTERM`, after which the socket
+ * is removed.
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+serve(
+    struct d6* d6, ///< state to roll dice with
+    char const* path ///< path of the socket to listen on
+);
+
+
+#endif
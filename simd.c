@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <pthread.h>
+
+#include "simd.h"
+
+
+/**
+ * Extension detected by `detect_simd_level()`
+ */
+static enum simd_level detected_level;
+
+
+/**
+ * Guard for detecting the extension
+ */
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Query the CPU for the most capable extension
+ */
+static void
+detect_simd_level(void) {
+    detected_level = SIMD_NONE;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        detected_level = SIMD_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        detected_level = SIMD_SSE2;
+#endif
+}
+
+
+enum simd_level
+simd_level(void) {
+    pthread_once(&detect_once, detect_simd_level);
+    return detected_level;
+}
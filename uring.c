@@ -0,0 +1,218 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+
+struct uring {
+    int fd; ///< file descriptor of the instance
+    void* sq_ring; ///< mapping of the submission queue ring
+    size_t sq_ring_len; ///< length of the submission queue ring mapping
+    void* cq_ring; ///< mapping of the completion queue ring
+    size_t cq_ring_len; ///< length of the completion queue ring mapping
+    struct io_uring_sqe* sqes; ///< submission queue entries
+    size_t sqes_len; ///< length of the submission queue entries mapping
+    unsigned int* sq_tail; ///< tail of the submission queue
+    unsigned int sq_mask; ///< mask for submission queue indices
+    unsigned int* sq_array; ///< indices of submitted entries
+    unsigned int* cq_head; ///< head of the completion queue
+    unsigned int* cq_tail; ///< tail of the completion queue
+    unsigned int cq_mask; ///< mask for completion queue indices
+    struct io_uring_cqe* cqes; ///< completion queue entries
+};
+
+
+/**
+ * Enter the kernel for submitting and/or waiting for requests
+ */
+static int
+uring_enter(
+    struct uring* ring, ///< instance to use
+    unsigned int submit, ///< number of entries to submit
+    unsigned int wait ///< number of completions to wait for
+) {
+    for (;;) {
+        long res = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                           wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (res >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+
+struct uring*
+uring_open(
+    unsigned int entries,
+    struct iovec const* bufs,
+    unsigned int count
+) {
+    struct uring* ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_ring_len = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_len > ring->sq_ring_len)
+            ring->sq_ring_len = ring->cq_ring_len;
+        ring->cq_ring_len = 0;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto fail_sq;
+
+    ring->cq_ring = ring->sq_ring;
+    if (ring->cq_ring_len > 0) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+            goto fail_cq;
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail_sqes;
+
+    char* const sq = ring->sq_ring;
+    ring->sq_tail = (unsigned int*) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*) (sq + params.sq_off.array);
+
+    char* const cq = ring->cq_ring;
+    ring->cq_head = (unsigned int*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int*) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+                bufs, count) < 0)
+        goto fail_register;
+
+    return ring;
+
+fail_register:
+    munmap(ring->sqes, ring->sqes_len);
+fail_sqes:
+    if (ring->cq_ring_len > 0)
+        munmap(ring->cq_ring, ring->cq_ring_len);
+fail_cq:
+    munmap(ring->sq_ring, ring->sq_ring_len);
+fail_sq:
+    close(ring->fd);
+    free(ring);
+    return NULL;
+}
+
+
+void
+uring_close(
+    struct uring* ring
+) {
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring_len > 0)
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    munmap(ring->sq_ring, ring->sq_ring_len);
+    close(ring->fd);
+    free(ring);
+}
+
+
+int
+uring_write_fixed(
+    struct uring* ring,
+    int fd,
+    void const* data,
+    size_t len,
+    off_t offset,
+    unsigned int buf_index,
+    uint64_t user_data
+) {
+    // we are the only producer, the kernel only advances the head
+    unsigned int const tail = *ring->sq_tail;
+    unsigned int const index = tail & ring->sq_mask;
+
+    struct io_uring_sqe* const sqe = ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t) data;
+    sqe->len = len;
+    sqe->buf_index = buf_index;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return uring_enter(ring, 1, 0);
+}
+
+
+int
+uring_wait(
+    struct uring* ring,
+    uint64_t* user_data,
+    int32_t* res
+) {
+    unsigned int const head = *ring->cq_head;
+    while (__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == head)
+        if (uring_enter(ring, 0, 1) < 0)
+            return -1;
+
+    struct io_uring_cqe const* const cqe = ring->cqes + (head & ring->cq_mask);
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#endif
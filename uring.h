@@ -0,0 +1,96 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Julian Ganz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+/**
+ * Minimal io_uring instance
+ *
+ * Only what is needed for issuing writes from registered buffers is supported.
+ * The ring is driven via the raw system calls, no library is required.
+ */
+struct uring;
+
+
+/**
+ * Set up an io_uring instance with registered buffers
+ *
+ * Returns the instance or `NULL` if io_uring is not available.
+ */
+struct uring*
+uring_open(
+    unsigned int entries, ///< number of submission queue entries
+    struct iovec const* bufs, ///< buffers to register
+    unsigned int count ///< number of buffers
+);
+
+
+/**
+ * Tear down an io_uring instance
+ *
+ * Writes still in flight are not waited for.
+ */
+void
+uring_close(
+    struct uring* ring ///< instance to tear down
+);
+
+
+/**
+ * Submit a write from a registered buffer
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+uring_write_fixed(
+    struct uring* ring, ///< instance to use
+    int fd, ///< file descriptor to write to
+    void const* data, ///< data to write, within the registered buffer
+    size_t len, ///< number of bytes to write
+    off_t offset, ///< offset in the file to write to
+    unsigned int buf_index, ///< index of the registered buffer
+    uint64_t user_data ///< value identifying the request on completion
+);
+
+
+/**
+ * Wait for the completion of a request
+ *
+ * Returns `0` on success, `-1` on error.
+ */
+int
+uring_wait(
+    struct uring* ring, ///< instance to use
+    uint64_t* user_data, ///< value identifying the completed request
+    int32_t* res ///< result of the request
+);
+
+
+#endif